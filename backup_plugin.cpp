@@ -22,10 +22,11 @@ Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
 
 #include <backup.h>
 
+#include "job.h"
 #include "manager.h"
+#include "oplog_archiver.h"
+#include "throttle.h"
 
-#include "mongo/base/status.h"
-#include "mongo/base/units.h"
 #include "mongo/db/auth/action_set.h"
 #include "mongo/db/auth/action_type.h"
 #include "mongo/db/auth/authorization_manager.h"
@@ -64,7 +65,13 @@ namespace mongo {
             }
             virtual void help(stringstream &h) const {
                 h << "Starts a hot backup." << endl
-                  << "{ backupStart: <destination directory> }";
+                  << "{ backupStart: <destination directory>, async: <bool>, cacheNeutral: <bool>, manifest: <bool>, oplog: <bool> }" << endl
+                  << "With async, returns a jobId immediately instead of waiting for the backup to finish; "
+                  << "use backupStatus to watch it and backupWait to collect the result." << endl
+                  << "With cacheNeutral, pages the backup pulls into the page cache are dropped again as it goes." << endl
+                  << "With manifest, writes backup.manifest listing every file with its size and CRC32C." << endl
+                  << "With oplog, archives the oplog under <destination>/oplog from before the backup until "
+                  << "backupOplogStop, for point-in-time recovery.";
             }
             virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
                 BSONElement e = cmdObj.firstElement();
@@ -73,8 +80,16 @@ namespace mongo {
                     errmsg = "invalid destination directory: '" + dest + "'";
                     return false;
                 }
-                Manager manager(cc());
-                return manager.start(dest, errmsg, result);
+                Options opts;
+                if (!opts.parse(cmdObj, errmsg)) {
+                    return false;
+                }
+                shared_ptr<Job> job = JobRegistry::create(dest, opts);
+                result.append("jobId", job->id());
+                if (cmdObj["async"].trueValue()) {
+                    return job->launch(errmsg);
+                }
+                return job->run(cc(), errmsg, result);
             }
         };
 
@@ -91,47 +106,262 @@ namespace mongo {
             virtual void help(stringstream &h) const {
                 h << "Throttles hot backup to consume only N bytes/sec of I/O." << endl
                   << "{ backupThrottle: <N> }" << endl
-                  << "N can be an integer or a string with a \"k/m/g\" suffix";
+                  << "N can be an integer or a string with a \"k/m/g\" suffix" << endl
+                  << "{ backupThrottle: { targetLatencyMs: <ms>, minBps: <N>, maxBps: <N> } }" << endl
+                  << "Adjusts the rate continuously to keep foreground operation latency near the target." << endl
+                  << "{ backupThrottle: { schedule: [ { from: \"HH:MM\", to: \"HH:MM\", bps: <N> }, ... ], defaultBps: <N> } }" << endl
+                  << "Uses the rate of the first window containing the current local time, or else defaultBps." << endl
+                  << "Any of these can be given with burst: <N>, to pace the copy smoothly with a token bucket "
+                  << "of N bytes instead of letting it copy in bursts and sleep (not with a rate of 0).";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                return Throttle::set(cmdObj.firstElement(), cmdObj["burst"], errmsg, result);
+            }
+        };
+
+        class BackupStatusCommand : public BackupCommand {
+          public:
+            BackupStatusCommand() : BackupCommand("backupStatus") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupStatus);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Report the current status of hot backup." << endl
+                  << "{ backupStatus: <N>, jobId: <jobId>, history: <bool> }" << endl
+                  << "Reports on the given job, or else the running backup, or else the last one to finish.  "
+                  << "With history, also lists every backup job still remembered.";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                long long jobId = -1;
+                BSONElement jobIdElt = cmdObj["jobId"];
+                if (!jobIdElt.eoo()) {
+                    if (!jobIdElt.isNumber()) {
+                        errmsg = "jobId must be a number";
+                        return false;
+                    }
+                    jobId = jobIdElt.safeNumberLong();
+                }
+                if (!JobRegistry::status(jobId, cmdObj["history"].trueValue(), errmsg, result)) {
+                    return false;
+                }
+                BSONObjBuilder tb(result.subobjStart("throttle"));
+                Throttle::get(tb);
+                tb.doneFast();
+                return true;
+            }
+        };
+
+        class BackupWaitCommand : public BackupCommand {
+          public:
+            BackupWaitCommand() : BackupCommand("backupWait") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupStatus);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Waits for an asynchronous hot backup to finish and reports its result." << endl
+                  << "{ backupWait: <jobId>, timeoutMillis: <N> }" << endl
+                  << "Without timeoutMillis, waits until the backup is done (or the wait is killed).";
             }
             virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
                 BSONElement e = cmdObj.firstElement();
-                long long bps;
-                if (e.type() == String) {
-                    Status status = BytesQuantity<long long>::fromString(e.Stringdata(), bps);
-                    if (!status.isOK()) {
-                        stringstream ss;
-                        ss << "error parsing number " << e.Stringdata() << ": " << status.codeString() << " " << status.reason();
-                        errmsg = ss.str();
+                if (!e.isNumber()) {
+                    errmsg = "backupWait argument must be a job id";
+                    return false;
+                }
+                long long timeoutMillis = 0;
+                BSONElement timeoutElt = cmdObj["timeoutMillis"];
+                if (!timeoutElt.eoo()) {
+                    if (!timeoutElt.isNumber()) {
+                        errmsg = "timeoutMillis must be a number";
                         return false;
                     }
+                    timeoutMillis = timeoutElt.safeNumberLong();
+                }
+                shared_ptr<Job> job = JobRegistry::find(e.safeNumberLong());
+                if (!job) {
+                    errmsg = "no such backup job";
+                    return false;
                 }
-                else {
-                    if (!e.isNumber()) {
-                        errmsg = "backupThrottle argument must be a number";
+                return job->wait(cc(), timeoutMillis, errmsg, result);
+            }
+        };
+
+        class BackupVerifyCommand : public BackupCommand {
+          public:
+            BackupVerifyCommand() : BackupCommand("backupVerify") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupStart);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Checks a hot backup against the manifest written by { backupStart: <dir>, manifest: true }." << endl
+                  << "{ backupVerify: <backup directory>, threads: <N> }";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                BSONElement e = cmdObj.firstElement();
+                string dir = e.str();
+                if (dir.empty()) {
+                    errmsg = "invalid backup directory: '" + dir + "'";
+                    return false;
+                }
+                long long threads = 4;
+                BSONElement threadsElt = cmdObj["threads"];
+                if (!threadsElt.eoo()) {
+                    if (!threadsElt.isNumber() || threadsElt.safeNumberLong() < 1 || threadsElt.safeNumberLong() > 64) {
+                        errmsg = "threads must be a number between 1 and 64";
                         return false;
                     }
-                    bps = e.safeNumberLong();
+                    threads = threadsElt.safeNumberLong();
                 }
-                return Manager::throttle(bps, errmsg, result);
+                return Manager::verifyBackup(cc(), dir, threads, errmsg, result);
             }
         };
 
-        class BackupStatusCommand : public BackupCommand {
+        class BackupOplogStopCommand : public BackupCommand {
           public:
-            BackupStatusCommand() : BackupCommand("backupStatus") {}
+            BackupOplogStopCommand() : BackupCommand("backupOplogStop") {}
             virtual void addRequiredPrivileges(const std::string& dbname,
                                                const BSONObj& cmdObj,
                                                std::vector<Privilege>* out) {
                 ActionSet actions;
-                actions.addAction(ActionType::backupStatus);
+                actions.addAction(ActionType::backupStart);
                 out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
             }
             virtual void help(stringstream &h) const {
-                h << "Report the current status of hot backup." << endl
-                  << "{ backupStatus: <N> }";
+                h << "Stops archiving the oplog for a backup started with { oplog: true }." << endl
+                  << "{ backupOplogStop: <jobId> }";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                BSONElement e = cmdObj.firstElement();
+                if (!e.isNumber()) {
+                    errmsg = "backupOplogStop argument must be a job id";
+                    return false;
+                }
+                shared_ptr<Job> job = JobRegistry::find(e.safeNumberLong());
+                if (!job) {
+                    errmsg = "no such backup job";
+                    return false;
+                }
+                shared_ptr<OplogArchiver> archiver = job->oplogArchiver();
+                if (!archiver) {
+                    errmsg = "backup job is not archiving the oplog";
+                    return false;
+                }
+                archiver->stop();
+                BSONObjBuilder ob(result.subobjStart("oplogArchive"));
+                archiver->get(ob);
+                ob.doneFast();
+                return true;
+            }
+        };
+
+        class BackupPauseCommand : public BackupCommand {
+          public:
+            BackupPauseCommand() : BackupCommand("backupPause") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupThrottle);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Pauses a running backup, which stops copying until backupResume but stays consistent." << endl
+                  << "{ backupPause: <jobId> }";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                BSONElement e = cmdObj.firstElement();
+                if (!e.isNumber()) {
+                    errmsg = "backupPause argument must be a job id";
+                    return false;
+                }
+                shared_ptr<Job> job = JobRegistry::find(e.safeNumberLong());
+                if (!job) {
+                    errmsg = "no such backup job";
+                    return false;
+                }
+                if (!job->pause(errmsg)) {
+                    return false;
+                }
+                job->get(result);
+                return true;
+            }
+        };
+
+        class BackupResumeCommand : public BackupCommand {
+          public:
+            BackupResumeCommand() : BackupCommand("backupResume") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupThrottle);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Resumes a backup paused with backupPause." << endl
+                  << "{ backupResume: <jobId> }";
             }
             virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
-                return Manager::status(errmsg, result);
+                BSONElement e = cmdObj.firstElement();
+                if (!e.isNumber()) {
+                    errmsg = "backupResume argument must be a job id";
+                    return false;
+                }
+                shared_ptr<Job> job = JobRegistry::find(e.safeNumberLong());
+                if (!job) {
+                    errmsg = "no such backup job";
+                    return false;
+                }
+                if (!job->resume(errmsg)) {
+                    return false;
+                }
+                job->get(result);
+                return true;
+            }
+        };
+
+        class BackupCancelCommand : public BackupCommand {
+          public:
+            BackupCancelCommand() : BackupCommand("backupCancel") {}
+            virtual void addRequiredPrivileges(const std::string& dbname,
+                                               const BSONObj& cmdObj,
+                                               std::vector<Privilege>* out) {
+                ActionSet actions;
+                actions.addAction(ActionType::backupStart);
+                out->push_back(Privilege(AuthorizationManager::SERVER_RESOURCE_NAME, actions));
+            }
+            virtual void help(stringstream &h) const {
+                h << "Cancels a backup, which then fails; use backupWait to wait for it to stop." << endl
+                  << "{ backupCancel: <jobId> }";
+            }
+            virtual bool run(const string &db, BSONObj &cmdObj, int options, string &errmsg, BSONObjBuilder &result, bool fromRepl) {
+                BSONElement e = cmdObj.firstElement();
+                if (!e.isNumber()) {
+                    errmsg = "backupCancel argument must be a job id";
+                    return false;
+                }
+                shared_ptr<Job> job = JobRegistry::find(e.safeNumberLong());
+                if (!job) {
+                    errmsg = "no such backup job";
+                    return false;
+                }
+                if (!job->cancel(errmsg)) {
+                    return false;
+                }
+                job->get(result);
+                return true;
             }
         };
 
@@ -151,6 +381,12 @@ namespace mongo {
                 cmds.push_back(boost::make_shared<BackupStartCommand>());
                 cmds.push_back(boost::make_shared<BackupThrottleCommand>());
                 cmds.push_back(boost::make_shared<BackupStatusCommand>());
+                cmds.push_back(boost::make_shared<BackupWaitCommand>());
+                cmds.push_back(boost::make_shared<BackupVerifyCommand>());
+                cmds.push_back(boost::make_shared<BackupOplogStopCommand>());
+                cmds.push_back(boost::make_shared<BackupPauseCommand>());
+                cmds.push_back(boost::make_shared<BackupResumeCommand>());
+                cmds.push_back(boost::make_shared<BackupCancelCommand>());
                 return cmds;
             }
 
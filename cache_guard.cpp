@@ -0,0 +1,232 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file cache_guard.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "cache_guard.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "mongo/base/string_data.h"
+#include "mongo/util/log.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        static long long pageSize() {
+            static const long long ps = sysconf(_SC_PAGESIZE);
+            return ps;
+        }
+
+        CacheGuard::CacheGuard() :
+                _source(),
+                _dest(),
+                _sourceFd(-1),
+                _destFd(-1),
+                _window(0),
+                _resident(),
+                _residentNext(),
+                _done(0),
+                _flushed(0),
+                _pendingFd(-1),
+                _pendingFrom(0)
+        {}
+
+        CacheGuard::~CacheGuard() {
+            finish();
+        }
+
+        void CacheGuard::poll(const StringData &source, const StringData &dest, long long done) {
+            if (!(source == StringData(_source)) || !(dest == StringData(_dest))) {
+                _retire();
+                _open(source, dest);
+            }
+            const long long end = done - done % pageSize();
+            if (end >= _done + kBatchBytes) {
+                _release(end);
+            }
+        }
+
+        void CacheGuard::finish() {
+            _retire();
+            _finishPending();
+        }
+
+        void CacheGuard::_open(const StringData &source, const StringData &dest) {
+            _source.assign(source.rawData(), source.size());
+            _dest.assign(dest.rawData(), dest.size());
+            _done = 0;
+            _flushed = 0;
+
+            _sourceFd = open(_source.c_str(), O_RDONLY);
+            if (_sourceFd < 0) {
+                LOG(1) << "backup cache guard couldn't open " << _source << ": " << errnoWithDescription() << endl;
+            }
+            _destFd = _dest.empty() ? -1 : open(_dest.c_str(), O_RDONLY);
+            if (_destFd < 0 && !_dest.empty()) {
+                LOG(1) << "backup cache guard couldn't open " << _dest << ": " << errnoWithDescription() << endl;
+            }
+
+            _window = 0;
+            _snapshot(0, _resident);
+            _snapshot(1, _residentNext);
+        }
+
+        void CacheGuard::_snapshot(long long window, std::vector<unsigned char> &resident) const {
+            resident.clear();
+            if (_sourceFd < 0) {
+                return;
+            }
+            struct stat st;
+            const long long start = window * kBatchBytes;
+            if (fstat(_sourceFd, &st) != 0 || st.st_size <= start) {
+                // Anything past the end now is written by the server during the backup, so it's
+                // hot and we leave it alone.
+                return;
+            }
+            const long long len = std::min(static_cast<long long>(st.st_size) - start, kBatchBytes);
+            void *p = mmap(NULL, len, PROT_READ, MAP_SHARED, _sourceFd, start);
+            if (p == MAP_FAILED) {
+                LOG(1) << "backup cache guard couldn't map " << _source << ": " << errnoWithDescription() << endl;
+                return;
+            }
+            resident.resize((len + pageSize() - 1) / pageSize());
+            if (mincore(p, len, &resident[0]) != 0) {
+                // Without knowing what was resident, we can't drop anything from the source safely.
+                LOG(1) << "backup cache guard couldn't check residency of " << _source << ": " << errnoWithDescription() << endl;
+                resident.clear();
+            }
+            munmap(p, len);
+        }
+
+        // Moves the windows along so the library's read position, pos, is in the first one.
+        void CacheGuard::_advance(long long pos) {
+            const long long window = pos / kBatchBytes;
+            if (window == _window) {
+                return;
+            }
+            if (window == _window + 1) {
+                _resident.swap(_residentNext);
+            }
+            else {
+                _snapshot(window, _resident);
+            }
+            _snapshot(window + 1, _residentNext);
+            _window = window;
+        }
+
+        // Pages we have no record for count as resident, so we leave them alone.
+        bool CacheGuard::_wasResident(long long page) const {
+            const long long pagesPerWindow = kBatchBytes / pageSize();
+            const long long window = page / pagesPerWindow;
+            const std::vector<unsigned char> *resident =
+                    window == _window ? &_resident : window == _window + 1 ? &_residentNext : NULL;
+            const size_t i = page - window * pagesPerWindow;
+            return resident == NULL || i >= resident->size() || ((*resident)[i] & 1);
+        }
+
+        void CacheGuard::_dropSource(long long firstPage, long long lastPage) {
+            const long long ps = pageSize();
+            long long run = -1;
+            for (long long i = firstPage; i < lastPage; ++i) {
+                if (!_wasResident(i)) {
+                    if (run < 0) {
+                        run = i;
+                    }
+                }
+                else if (run >= 0) {
+                    posix_fadvise(_sourceFd, run * ps, (i - run) * ps, POSIX_FADV_DONTNEED);
+                    run = -1;
+                }
+            }
+            if (run >= 0) {
+                posix_fadvise(_sourceFd, run * ps, (lastPage - run) * ps, POSIX_FADV_DONTNEED);
+            }
+        }
+
+        void CacheGuard::_release(long long end) {
+            if (_sourceFd >= 0) {
+                _dropSource(_done / pageSize(), end / pageSize());
+            }
+
+            if (_destFd >= 0) {
+                // DONTNEED skips dirty pages, so they have to be written first.  We start
+                // writeback of this batch and only wait for the previous one, which has had a
+                // batch's worth of copying to finish.
+                sync_file_range(_destFd, _done, end - _done, SYNC_FILE_RANGE_WRITE);
+                if (_done > _flushed) {
+                    sync_file_range(_destFd, _flushed, _done - _flushed,
+                                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                    posix_fadvise(_destFd, _flushed, _done - _flushed, POSIX_FADV_DONTNEED);
+                    _flushed = _done;
+                }
+            }
+            _finishPending();
+
+            _done = end;
+            _advance(end);
+        }
+
+        // The library has moved on from the current file.  Drops what's left of the source,
+        // starts writeback of the rest of the destination and leaves it pending, and closes
+        // both.
+        void CacheGuard::_retire() {
+            if (_sourceFd >= 0) {
+                // Through the end of what we have a record for.
+                _dropSource(_done / pageSize(), (_window + 2) * (kBatchBytes / pageSize()));
+                close(_sourceFd);
+                _sourceFd = -1;
+            }
+            if (_destFd >= 0) {
+                // A length of 0 means through the end of the file.
+                sync_file_range(_destFd, _done, 0, SYNC_FILE_RANGE_WRITE);
+                _finishPending();
+                _pendingFd = _destFd;
+                _pendingFrom = _flushed;
+                _destFd = -1;
+            }
+            _source.clear();
+            _dest.clear();
+            std::vector<unsigned char>().swap(_resident);
+            std::vector<unsigned char>().swap(_residentNext);
+            _window = 0;
+            _done = 0;
+            _flushed = 0;
+        }
+
+        void CacheGuard::_finishPending() {
+            if (_pendingFd < 0) {
+                return;
+            }
+            sync_file_range(_pendingFd, _pendingFrom, 0,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(_pendingFd, _pendingFrom, 0, POSIX_FADV_DONTNEED);
+            close(_pendingFd);
+            _pendingFd = -1;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
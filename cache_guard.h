@@ -0,0 +1,100 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file cache_guard.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <vector>
+
+#include "mongo/base/string_data.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * Keeps a backup from flushing the server's working set out of the page cache.
+         *
+         * The backup library reads and writes through the page cache and we can't change how it
+         * opens files, so instead we follow along from the poll callback.  The library reads
+         * each source file sequentially, so we record which pages of the kBatchBytes window
+         * after the one it's reading are resident (with mincore) before it gets there, and as
+         * the copy moves through the file we drop, in kBatchBytes steps, the source pages that
+         * weren't resident before the backup touched them, and write back and drop the
+         * destination's pages.  Pages the server had cached stay cached, as do pages whose
+         * residency we never recorded.  Writeback of each destination batch is only started when
+         * we reach it, and waited for (and the batch dropped) one batch later, so the copy
+         * doesn't stall on it; the end of a finished file is likewise waited for at the next
+         * batch or file, and only finish() waits for everything.
+         *
+         * The first two windows of a file are recorded at its first report, by which point the
+         * library has already read up to one buffer of it; pages of that prefix it pulled in
+         * look resident and are left cached.
+         */
+        class CacheGuard : boost::noncopyable {
+            string _source;
+            string _dest;
+            int _sourceFd;
+            int _destFd;
+            // One byte per source page of window _window and of the next one, recorded before the
+            // library read them, low bit set if the page was resident.
+            long long _window;
+            std::vector<unsigned char> _resident;
+            std::vector<unsigned char> _residentNext;
+            long long _done;
+            // Destination pages before this have been written back and dropped.
+            long long _flushed;
+            // The previous file's destination, whose writeback from _pendingFrom on was started
+            // but not yet waited for.
+            int _pendingFd;
+            long long _pendingFrom;
+
+            void _open(const StringData &source, const StringData &dest);
+            void _snapshot(long long window, std::vector<unsigned char> &resident) const;
+            void _advance(long long pos);
+            bool _wasResident(long long page) const;
+            void _dropSource(long long firstPage, long long lastPage);
+            void _release(long long end);
+            void _retire();
+            void _finishPending();
+
+          public:
+            static const long long kBatchBytes = 64 << 20;
+
+            CacheGuard();
+            ~CacheGuard();
+
+            /**
+             * Called with each report from the library of how far it is through copying source to
+             * dest.  With an empty dest, just follows reads of source.
+             */
+            void poll(const StringData &source, const StringData &dest, long long done);
+
+            /**
+             * Releases whatever is left of the files we've followed, waiting for their writeback.
+             */
+            void finish();
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,174 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file checksum.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "checksum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+namespace mongo {
+
+    namespace backup {
+
+        namespace {
+
+            // Reflected Castagnoli polynomial.
+            const uint32_t kPoly = 0x82f63b78;
+
+            struct Tables {
+                uint32_t t[8][256];
+                Tables() {
+                    for (uint32_t i = 0; i < 256; ++i) {
+                        uint32_t c = i;
+                        for (int k = 0; k < 8; ++k) {
+                            c = (c & 1) ? (c >> 1) ^ kPoly : c >> 1;
+                        }
+                        t[0][i] = c;
+                    }
+                    for (uint32_t i = 0; i < 256; ++i) {
+                        for (int s = 1; s < 8; ++s) {
+                            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+                        }
+                    }
+                }
+            };
+            const Tables tables;
+
+            uint32_t crc32cSoftware(uint32_t crc, const unsigned char *p, size_t len) {
+                const uint32_t (&t)[8][256] = tables.t;
+                while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+                    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+                    --len;
+                }
+                while (len >= 8) {
+                    uint64_t v;
+                    memcpy(&v, p, 8);
+                    v ^= crc;
+                    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+                          t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+                    p += 8;
+                    len -= 8;
+                }
+                while (len > 0) {
+                    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+                    --len;
+                }
+                return crc;
+            }
+
+#if defined(__x86_64__)
+            __attribute__((target("sse4.2")))
+            uint32_t crc32cHardware(uint32_t crc, const unsigned char *p, size_t len) {
+                while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+                    crc = __builtin_ia32_crc32qi(crc, *p++);
+                    --len;
+                }
+                uint64_t c = crc;
+                while (len >= 8) {
+                    uint64_t v;
+                    memcpy(&v, p, 8);
+                    c = __builtin_ia32_crc32di(c, v);
+                    p += 8;
+                    len -= 8;
+                }
+                crc = static_cast<uint32_t>(c);
+                while (len > 0) {
+                    crc = __builtin_ia32_crc32qi(crc, *p++);
+                    --len;
+                }
+                return crc;
+            }
+
+            bool cpuHasSse42() {
+                unsigned int eax, ebx, ecx, edx;
+                if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+                    return false;
+                }
+                return (ecx & bit_SSE4_2) != 0;
+            }
+
+            const bool useHardware = cpuHasSse42();
+#else
+            const bool useHardware = false;
+#endif
+
+        } // namespace
+
+        void Crc32c::update(const void *data, size_t len) {
+            const unsigned char *p = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__)
+            if (useHardware) {
+                _crc = crc32cHardware(_crc, p, len);
+                return;
+            }
+#endif
+            _crc = crc32cSoftware(_crc, p, len);
+        }
+
+        bool Crc32c::hardware() {
+            return useHardware;
+        }
+
+        bool checksumFile(const std::string &path, std::vector<char> &buf,
+                          uint64_t &size, uint32_t &crc, std::string &errmsg,
+                          ChecksumListener *listener) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                errmsg = "could not open " + path + ": " + strerror(errno);
+                return false;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+            Crc32c c;
+            size = 0;
+            for (;;) {
+                ssize_t n = read(fd, &buf[0], buf.size());
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    errmsg = "could not read " + path + ": " + strerror(errno);
+                    close(fd);
+                    return false;
+                }
+                if (n == 0) {
+                    break;
+                }
+                c.update(&buf[0], n);
+                size += n;
+                if (listener != NULL && !listener->read(path, size, n)) {
+                    errmsg = "stopped while reading " + path;
+                    close(fd);
+                    return false;
+                }
+            }
+            close(fd);
+            crc = c.value();
+            return true;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,73 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file checksum.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// This file is shared with the offline restore tool, so it only depends on the standard library.
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * CRC32C (Castagnoli), using the SSE4.2 crc32 instruction when the CPU has it and a
+         * slicing-by-8 table otherwise.
+         */
+        class Crc32c {
+            uint32_t _crc;
+          public:
+            Crc32c() : _crc(0xffffffff) {}
+            void update(const void *data, size_t len);
+            uint32_t value() const { return ~_crc; }
+
+            // Whether update() is using the hardware instruction.
+            static bool hardware();
+        };
+
+        /**
+         * Hears about every buffer checksumFile reads, so the caller can report progress, pace
+         * the reads or give up partway through a large file.
+         */
+        class ChecksumListener {
+          public:
+            virtual ~ChecksumListener() {}
+            // done is how far into path we've read, after a read of len bytes.  Returning false
+            // stops the read.
+            virtual bool read(const std::string &path, uint64_t done, size_t len) = 0;
+        };
+
+        /**
+         * Reads the file at path sequentially through buf (which must not be empty), and
+         * reports its size and CRC32C.  On failure, or if listener stops it, returns false with
+         * errmsg set.
+         */
+        bool checksumFile(const std::string &path, std::vector<char> &buf,
+                          uint64_t &size, uint32_t &crc, std::string &errmsg,
+                          ChecksumListener *listener = NULL);
+
+    } // namespace backup
+
+} // namespace mongo
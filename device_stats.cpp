@@ -0,0 +1,188 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file device_stats.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "device_stats.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include "mongo/base/string_data.h"
+#include "mongo/util/log.h"
+#include "mongo/util/time_support.h"
+
+#include "progress.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        DeviceStats::DeviceStats() :
+                _lock(),
+                _count(0),
+                _dirsMutex("backup device stats"),
+                _dirs(),
+                _currentSource(),
+                _currentKnown(false),
+                _currentDev(0),
+                _lastBytesDone(0)
+        {}
+
+        DeviceStats::Device *DeviceStats::_find(dev_t dev) {
+            for (int i = 0; i < _count; ++i) {
+                if (_devices[i].dev == dev) {
+                    return &_devices[i];
+                }
+            }
+            if (_count == kMaxDevices) {
+                return NULL;
+            }
+            Device &d = _devices[_count++];
+            d = Device();
+            d.dev = dev;
+            return &d;
+        }
+
+        void DeviceStats::addSourceDir(const string &dir) {
+            struct stat st;
+            if (stat(dir.c_str(), &st) != 0) {
+                LOG(1) << "backup: could not stat " << dir << ": " << errnoWithDescription() << endl;
+                return;
+            }
+            {
+                SimpleMutex::scoped_lock lk(_dirsMutex);
+                _dirs.insert(std::make_pair(st.st_dev, dir));
+            }
+            const unsigned seq = _lock.beginWrite();
+            _find(st.st_dev);
+            _lock.endWrite(seq);
+        }
+
+        void DeviceStats::_charge(dev_t dev, long long bytes, bool newFile, unsigned long long now) {
+            Device *d = _find(dev);
+            if (d == NULL) {
+                return;
+            }
+            if (d->firstMillis == 0) {
+                d->firstMillis = now;
+            }
+            d->lastMillis = now;
+            d->bytes += bytes;
+            if (newFile) {
+                d->files++;
+            }
+        }
+
+        void DeviceStats::poll(const ProgressRecord &record) {
+            if (record.phase != ProgressRecord::COPYING && record.phase != ProgressRecord::THROTTLED) {
+                return;
+            }
+            const unsigned long long now = curTimeMillis64();
+            long long delta = record.bytesDone - _lastBytesDone;
+            _lastBytesDone = record.bytesDone;
+            if (delta < 0) {
+                delta = 0;
+            }
+
+            if (record.source == StringData(_currentSource)) {
+                if (_currentKnown && delta > 0) {
+                    const unsigned seq = _lock.beginWrite();
+                    _charge(_currentDev, delta, false, now);
+                    _lock.endWrite(seq);
+                }
+                return;
+            }
+
+            // Whatever was copied since the last report beyond this file's progress went to
+            // finishing the previous file.
+            const long long current = std::min(delta, record.currentDone);
+            const bool previousKnown = _currentKnown;
+            const dev_t previousDev = _currentDev;
+
+            _currentSource = record.source.toString();
+            struct stat st;
+            _currentKnown = stat(_currentSource.c_str(), &st) == 0;
+            if (!_currentKnown) {
+                LOG(1) << "backup: could not stat " << _currentSource << ": " << errnoWithDescription() << endl;
+            }
+            else {
+                _currentDev = st.st_dev;
+            }
+
+            const unsigned seq = _lock.beginWrite();
+            if (previousKnown && delta > current) {
+                _charge(previousDev, delta - current, false, now);
+            }
+            if (_currentKnown) {
+                _charge(_currentDev, current, true, now);
+            }
+            _lock.endWrite(seq);
+        }
+
+        void DeviceStats::get(BSONArrayBuilder &b) const {
+            Device devices[kMaxDevices];
+            int count;
+            unsigned seq;
+            do {
+                seq = _lock.beginRead();
+                // May be torn if we raced with the writer, clamp it and let the sequence check
+                // throw the result away.
+                count = std::min(std::max(_count, 0), static_cast<int>(kMaxDevices));
+                std::copy(_devices, _devices + count, devices);
+            } while (_lock.retryRead(seq));
+
+            std::multimap<dev_t, string> dirs;
+            {
+                SimpleMutex::scoped_lock lk(_dirsMutex);
+                dirs = _dirs;
+            }
+
+            for (int i = 0; i < count; ++i) {
+                const Device &d = devices[i];
+                BSONObjBuilder db(b.subobjStart());
+                stringstream ss;
+                ss << major(d.dev) << ":" << minor(d.dev);
+                db.append("device", ss.str());
+                typedef std::multimap<dev_t, string>::const_iterator DirIterator;
+                const std::pair<DirIterator, DirIterator> range = dirs.equal_range(d.dev);
+                if (range.first != range.second) {
+                    BSONArrayBuilder ab(db.subarrayStart("dirs"));
+                    for (DirIterator dit = range.first; dit != range.second; ++dit) {
+                        ab.append(dit->second);
+                    }
+                    ab.doneFast();
+                }
+                db.append("bytesDone", d.bytes);
+                db.append("files", d.files);
+                // The rate while this device was being copied, not averaged over the whole backup.
+                const unsigned long long active = d.lastMillis - d.firstMillis;
+                db.append("activeMillis", static_cast<long long>(active));
+                if (active > 0) {
+                    db.append("bytesPerSec", static_cast<long long>(d.bytes * 1000 / active));
+                }
+                db.doneFast();
+            }
+        }
+
+    } // namespace backup
+
+} // namespace mongo
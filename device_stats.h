@@ -0,0 +1,98 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file device_stats.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <map>
+#include <sys/types.h>
+
+#include "seqlock.h"
+
+#include "mongo/db/jsobj.h"
+#include "mongo/util/concurrency/mutex.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        struct ProgressRecord;
+
+        /**
+         * Per-device accounting for a backup.  The library only tells us its total bytes done
+         * and which file it's on, so from the poll callback we charge each increase in bytes
+         * done to the device (st_dev) the current source file lives on.  The source directories
+         * are registered up front, so a device that hasn't been reached yet still shows up.
+         *
+         * addSourceDir() is called before the backup starts and poll() only from the library's
+         * thread, so there's one writer at a time; get() may be called from anywhere.  The
+         * counters are published through a SeqLock so that poll() never waits for get(), and
+         * poll() does its stat() before touching them.  Devices past kMaxDevices aren't
+         * tracked.
+         */
+        class DeviceStats : boost::noncopyable {
+          public:
+            static const int kMaxDevices = 32;
+
+          private:
+            struct Device {
+                dev_t dev;
+                long long bytes;
+                int files;
+                // When the first and latest bytes were charged to this device.
+                unsigned long long firstMillis;
+                unsigned long long lastMillis;
+
+                Device() : dev(0), bytes(0), files(0), firstMillis(0), lastMillis(0) {}
+            };
+
+            SeqLock _lock;
+            Device _devices[kMaxDevices];
+            int _count;
+
+            // The source directories on each device, which poll() never looks at.
+            mutable SimpleMutex _dirsMutex;
+            std::multimap<dev_t, string> _dirs;
+
+            // Only touched by poll().
+            string _currentSource;
+            bool _currentKnown;
+            dev_t _currentDev;
+            long long _lastBytesDone;
+
+            // Only called by the writer, between _lock.beginWrite() and _lock.endWrite().
+            Device *_find(dev_t dev);
+            void _charge(dev_t dev, long long bytes, bool newFile, unsigned long long now);
+
+          public:
+            DeviceStats();
+
+            void addSourceDir(const string &dir);
+
+            void poll(const ProgressRecord &record);
+
+            void get(BSONArrayBuilder &b) const;
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,69 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file file_queue.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "file_queue.h"
+
+#include <algorithm>
+
+namespace mongo {
+
+    namespace backup {
+
+        namespace {
+
+            struct LargerFirst {
+                const Manifest &m;
+                explicit LargerFirst(const Manifest &manifest) : m(manifest) {}
+                bool operator()(size_t a, size_t b) const {
+                    return m.files[a].size > m.files[b].size;
+                }
+            };
+
+        } // namespace
+
+        FileQueue::FileQueue(const Manifest &manifest) :
+                _order(),
+                _mutex(),
+                _next(0),
+                _closed(false)
+        {
+            _order.reserve(manifest.files.size());
+            for (size_t i = 0; i < manifest.files.size(); ++i) {
+                _order.push_back(i);
+            }
+            std::stable_sort(_order.begin(), _order.end(), LargerFirst(manifest));
+        }
+
+        bool FileQueue::next(size_t &i) {
+            boost::mutex::scoped_lock lk(_mutex);
+            if (_closed || _next == _order.size()) {
+                return false;
+            }
+            i = _order[_next++];
+            return true;
+        }
+
+        void FileQueue::close() {
+            boost::mutex::scoped_lock lk(_mutex);
+            _closed = true;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
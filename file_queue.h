@@ -0,0 +1,68 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file file_queue.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "manifest.h"
+
+// This file is shared with the offline restore tool, so it only depends on the standard library
+// and boost.
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * Hands out the files of a Manifest to a pool of threads, largest first so one big file
+         * doesn't end up being read alone at the end.  Each thread reads its files sequentially
+         * in kBufferSize pieces.
+         */
+        class FileQueue : boost::noncopyable {
+            std::vector<size_t> _order;
+            boost::mutex _mutex;
+            size_t _next;
+            bool _closed;
+
+          public:
+            static const size_t kBufferSize = 4 << 20;
+
+            explicit FileQueue(const Manifest &manifest);
+
+            /**
+             * Sets i to the index in the manifest of the next file to work on.  Returns false
+             * once every file has been handed out, or after close().
+             */
+            bool next(size_t &i);
+
+            /**
+             * Stops handing out files, e.g. because there's no point carrying on.
+             */
+            void close();
+        };
+
+    } // namespace backup
+
+} // namespace mongo
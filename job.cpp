@@ -0,0 +1,488 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file job.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "job.h"
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include <boost/thread/thread.hpp>
+
+#include "manager.h"
+#include "oplog_archiver.h"
+#include "progress.h"
+
+#include "mongo/db/client.h"
+#include "mongo/db/jsobj.h"
+#include "mongo/db/kill_current_op.h"
+#include "mongo/util/concurrency/mutex.h"
+#include "mongo/util/log.h"
+#include "mongo/util/time_support.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        bool Options::parse(const BSONObj &cmdObj, string &errmsg) {
+            cacheNeutral = cmdObj["cacheNeutral"].trueValue();
+            manifest = cmdObj["manifest"].trueValue();
+            oplog = cmdObj["oplog"].trueValue();
+            return true;
+        }
+
+        void Options::get(BSONObjBuilder &b) const {
+            b.appendBool("cacheNeutral", cacheNeutral);
+            b.appendBool("manifest", manifest);
+            b.appendBool("oplog", oplog);
+        }
+
+        Job::Job(long long id, const string &dest, const Options &options) :
+                _id(id),
+                _dest(dest),
+                _options(options),
+                _progress(),
+                _devices(),
+                _mutex("backup job"),
+                _doneCond(),
+                _resumeCond(),
+                _state(PENDING),
+                _startTime(0),
+                _endTime(0),
+                _errmsg(),
+                _result(),
+                _oplogArchiver(),
+                _paused(0),
+                _pausedSince(0),
+                _pausedMillis(0),
+                _cancelled(0)
+        {}
+
+        Job::State Job::state() const {
+            mongo::mutex::scoped_lock lk(_mutex);
+            return _state;
+        }
+
+        bool Job::finished() const {
+            State s = state();
+            return s == SUCCEEDED || s == FAILED;
+        }
+
+        bool Job::archiving() const {
+            shared_ptr<OplogArchiver> archiver = oplogArchiver();
+            return archiver && archiver->running();
+        }
+
+        void Job::setOplogArchiver(const shared_ptr<OplogArchiver> &archiver) {
+            mongo::mutex::scoped_lock lk(_mutex);
+            _oplogArchiver = archiver;
+        }
+
+        shared_ptr<OplogArchiver> Job::oplogArchiver() const {
+            mongo::mutex::scoped_lock lk(_mutex);
+            return _oplogArchiver;
+        }
+
+        const char *Job::stateName(State state) {
+            switch (state) {
+            case PENDING:
+                return "pending";
+            case RUNNING:
+                return "running";
+            case SUCCEEDED:
+                return "succeeded";
+            case FAILED:
+                return "failed";
+            }
+            return "unknown";
+        }
+
+        bool Job::run(Client &c, string &errmsg, BSONObjBuilder &result) {
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                _startTime = curTimeMillis64();
+            }
+
+            bool ok = false;
+            string err;
+            BSONObjBuilder b;
+            try {
+                Manager manager(c, *this);
+                ok = manager.start(_dest, err, b);
+            } catch (const std::exception &e) {
+                // The job has to reach a final state no matter what, so catch this here and
+                // report it like any other failure.
+                LOG(0) << "backup job " << _id << " failed: " << e.what() << endl;
+                ok = false;
+                err = e.what();
+            }
+            BSONObj res = b.obj();
+            _finish(ok, err, res);
+
+            result.appendElements(res);
+            errmsg = err;
+            return ok;
+        }
+
+        void Job::_finish(bool ok, const string &errmsg, const BSONObj &result) {
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                _state = ok ? SUCCEEDED : FAILED;
+                _endTime = curTimeMillis64();
+                if (_paused.load()) {
+                    _paused.store(0);
+                    _pausedMillis += _endTime - _pausedSince;
+                }
+                _errmsg = errmsg;
+                _result = result;
+            }
+            _doneCond.notify_all();
+            JobRegistry::finished(shared_from_this());
+        }
+
+        bool Job::launch(string &errmsg) {
+            LOG(1) << "Starting backup job " << _id << " on " << _dest << endl;
+            try {
+                boost::thread worker(boost::bind(&Job::_runInThread, shared_from_this()));
+            } catch (const std::exception &e) {
+                // Otherwise the job would be pending forever, and backupWait with it.
+                LOG(0) << "could not start backup job " << _id << ": " << e.what() << endl;
+                errmsg = string("could not start backup thread: ") + e.what();
+                _finish(false, errmsg, BSONObj());
+                return false;
+            }
+            return true;
+        }
+
+        void Job::_runInThread() {
+            Client::initThread("backup");
+            string errmsg;
+            BSONObjBuilder b;
+            run(cc(), errmsg, b);
+            cc().shutdown();
+        }
+
+        void Job::running() {
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                _state = RUNNING;
+            }
+            JobRegistry::setCurrent(shared_from_this());
+        }
+
+        bool Job::pause(string &errmsg) {
+            mongo::mutex::scoped_lock lk(_mutex);
+            if (_state == SUCCEEDED || _state == FAILED) {
+                errmsg = "backup job has already finished";
+                return false;
+            }
+            if (!_paused.load()) {
+                LOG(0) << "Pausing backup job " << _id << endl;
+                _paused.store(1);
+                _pausedSince = curTimeMillis64();
+            }
+            return true;
+        }
+
+        bool Job::resume(string &errmsg) {
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                if (_state == SUCCEEDED || _state == FAILED) {
+                    errmsg = "backup job has already finished";
+                    return false;
+                }
+                if (_paused.load()) {
+                    LOG(0) << "Resuming backup job " << _id << endl;
+                    _paused.store(0);
+                    _pausedMillis += curTimeMillis64() - _pausedSince;
+                }
+            }
+            _resumeCond.notify_all();
+            return true;
+        }
+
+        bool Job::cancel(string &errmsg) {
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                if (_state == SUCCEEDED || _state == FAILED) {
+                    errmsg = "backup job has already finished";
+                    return false;
+                }
+                if (!_cancelled.load()) {
+                    LOG(0) << "Cancelling backup job " << _id << endl;
+                    _cancelled.store(1);
+                }
+            }
+            // A paused backup has to wake up to notice.
+            _resumeCond.notify_all();
+            return true;
+        }
+
+        string Job::interrupted(Client &c) const {
+            if (_cancelled.load()) {
+                return "backup cancelled";
+            }
+            return killCurrentOp.checkForInterruptNoAssert(c);
+        }
+
+        string Job::waitWhilePaused(Client &c) {
+            while (true) {
+                if (!_paused.load()) {
+                    return "";
+                }
+                {
+                    mongo::mutex::scoped_lock lk(_mutex);
+                    if (!_paused.load()) {
+                        return "";
+                    }
+                    _resumeCond.timed_wait(lk.boost(), boost::posix_time::milliseconds(kPauseCheckMillis));
+                    if (!_paused.load()) {
+                        return "";
+                    }
+                }
+                // Don't hold up a cancel, kill or shutdown just because we're paused.
+                string killed = interrupted(c);
+                if (!killed.empty()) {
+                    return killed;
+                }
+            }
+        }
+
+        bool Job::wait(Client &c, long long timeoutMillis, string &errmsg, BSONObjBuilder &result) {
+            const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeoutMillis);
+            string killed;
+            mongo::mutex::scoped_lock lk(_mutex);
+            while (_state != SUCCEEDED && _state != FAILED) {
+                // Wait in slices so a killOp on the waiting command gets through.
+                boost::system_time until = boost::get_system_time() + boost::posix_time::milliseconds(kWaitCheckMillis);
+                if (timeoutMillis > 0 && deadline < until) {
+                    until = deadline;
+                }
+                _doneCond.timed_wait(lk.boost(), until);
+                if (_state == SUCCEEDED || _state == FAILED) {
+                    break;
+                }
+                if (timeoutMillis > 0 && boost::get_system_time() >= deadline) {
+                    break;
+                }
+                killed = killCurrentOp.checkForInterruptNoAssert(c);
+                if (!killed.empty()) {
+                    break;
+                }
+            }
+            result.append("jobId", _id);
+            if (_state != SUCCEEDED && _state != FAILED) {
+                errmsg = killed.empty() ? "timed out waiting for backup job" : "interrupted waiting for backup job: " + killed;
+                result.appendBool("done", false);
+                return false;
+            }
+            result.appendBool("done", true);
+            result.appendElements(_result);
+            errmsg = _errmsg;
+            return _state == SUCCEEDED;
+        }
+
+        void Job::get(BSONObjBuilder &b) const {
+            State state;
+            unsigned long long startTime;
+            unsigned long long endTime;
+            string errmsg;
+            BSONObj res;
+            shared_ptr<OplogArchiver> archiver;
+            bool paused;
+            unsigned long long pausedMillis;
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                state = _state;
+                paused = _paused.load();
+                pausedMillis = _pausedMillis + (paused ? curTimeMillis64() - _pausedSince : 0);
+                startTime = _startTime;
+                endTime = _endTime;
+                errmsg = _errmsg;
+                res = _result;
+                archiver = _oplogArchiver;
+            }
+            const bool done = state == SUCCEEDED || state == FAILED;
+
+            b.append("jobId", _id);
+            b.append("state", stateName(state));
+            b.append("dest", _dest);
+            {
+                BSONObjBuilder ob(b.subobjStart("options"));
+                _options.get(ob);
+                ob.doneFast();
+            }
+            if (startTime != 0) {
+                b.appendDate("startTime", Date_t(startTime));
+            }
+            if (done) {
+                b.appendDate("endTime", Date_t(endTime));
+            }
+            b.appendBool("paused", paused);
+            if (_cancelled.load()) {
+                b.appendBool("cancelled", true);
+            }
+            b.append("pausedMillis", static_cast<long long>(pausedMillis));
+
+            Progress::Snapshot snapshot;
+            _progress.read(snapshot);
+            snapshot.get(b);
+
+            if (startTime != 0) {
+                const unsigned long long now = curTimeMillis64();
+                const unsigned long long elapsed = (done ? endTime : now) - startTime;
+                if (elapsed > 0) {
+                    b.append("bytesPerSec", static_cast<long long>(snapshot.bytesDone * 1000 / elapsed));
+                    // Whether the throttle or the disks are holding the backup back.
+                    const long long sleepMicros = snapshot.librarySleepMicros + snapshot.pacedSleepMicros;
+                    b.append("throttledFraction", std::min(1.0, sleepMicros / (elapsed * 1000.0)));
+                }
+                if (!done) {
+                    BSONObjBuilder rb(b.subobjStart("recent"));
+                    snapshot.getRates(rb, now);
+                    rb.doneFast();
+                }
+            }
+
+            {
+                BSONArrayBuilder db(b.subarrayStart("devices"));
+                _devices.get(db);
+                db.doneFast();
+            }
+
+            if (archiver) {
+                BSONObjBuilder ob(b.subobjStart("oplogArchive"));
+                archiver->get(ob);
+                ob.doneFast();
+            }
+
+            if (done) {
+                BSONObjBuilder rb(b.subobjStart("result"));
+                rb.appendBool("ok", state == SUCCEEDED);
+                if (!errmsg.empty()) {
+                    rb.append("errmsg", errmsg);
+                }
+                rb.appendElements(res);
+                rb.doneFast();
+            }
+        }
+
+        SimpleMutex JobRegistry::_mutex("backup jobs");
+        long long JobRegistry::_nextId = 1;
+        std::deque<shared_ptr<Job> > JobRegistry::_jobs;
+        shared_ptr<Job> JobRegistry::_current;
+
+        shared_ptr<Job> JobRegistry::create(const string &dest, const Options &options) {
+            SimpleMutex::scoped_lock lk(_mutex);
+            shared_ptr<Job> job = boost::make_shared<Job>(_nextId++, dest, options);
+            _jobs.push_back(job);
+            return job;
+        }
+
+        shared_ptr<Job> JobRegistry::find(long long id) {
+            SimpleMutex::scoped_lock lk(_mutex);
+            for (std::deque<shared_ptr<Job> >::const_iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                if ((*it)->id() == id) {
+                    return *it;
+                }
+            }
+            return shared_ptr<Job>();
+        }
+
+        void JobRegistry::setCurrent(const shared_ptr<Job> &job) {
+            SimpleMutex::scoped_lock lk(_mutex);
+            _current = job;
+        }
+
+        void JobRegistry::finished(const shared_ptr<Job> &job) {
+            SimpleMutex::scoped_lock lk(_mutex);
+            // Only the job itself ever clears its own slot, so a backup that finishes late can't
+            // clobber the next one.
+            if (_current == job) {
+                _current.reset();
+            }
+
+            // Jobs still archiving the oplog are kept regardless, so they can be found and stopped.
+            size_t finishedCount = 0;
+            for (std::deque<shared_ptr<Job> >::const_iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                if ((*it)->finished() && !(*it)->archiving()) {
+                    ++finishedCount;
+                }
+            }
+            for (std::deque<shared_ptr<Job> >::iterator it = _jobs.begin();
+                 it != _jobs.end() && finishedCount > kHistorySize; ) {
+                if ((*it)->finished() && !(*it)->archiving()) {
+                    it = _jobs.erase(it);
+                    --finishedCount;
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+        bool JobRegistry::status(long long jobId, bool history, string &errmsg, BSONObjBuilder &result) {
+            shared_ptr<Job> job;
+            std::vector<shared_ptr<Job> > jobs;
+            {
+                SimpleMutex::scoped_lock lk(_mutex);
+                if (jobId >= 0) {
+                    for (std::deque<shared_ptr<Job> >::const_iterator it = _jobs.begin(); it != _jobs.end(); ++it) {
+                        if ((*it)->id() == jobId) {
+                            job = *it;
+                            break;
+                        }
+                    }
+                }
+                else if (_current) {
+                    job = _current;
+                }
+                else if (!_jobs.empty()) {
+                    job = _jobs.back();
+                }
+                if (history) {
+                    jobs.assign(_jobs.begin(), _jobs.end());
+                }
+            }
+
+            if (!job) {
+                errmsg = jobId >= 0 ? "no such backup job" : "no backup running";
+                return false;
+            }
+
+            // Reading a job's progress never blocks its backup, and we're no longer holding the
+            // registry lock, so building all this doesn't hold anyone else up either.
+            job->get(result);
+            if (history) {
+                BSONArrayBuilder ab(result.subarrayStart("history"));
+                for (std::vector<shared_ptr<Job> >::const_iterator it = jobs.begin(); it != jobs.end(); ++it) {
+                    BSONObjBuilder jb(ab.subobjStart());
+                    (*it)->get(jb);
+                    jb.doneFast();
+                }
+                ab.doneFast();
+            }
+            return true;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
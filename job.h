@@ -0,0 +1,219 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file job.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <deque>
+
+#include <boost/thread/condition.hpp>
+
+#include "device_stats.h"
+#include "progress.h"
+
+#include "mongo/db/client.h"
+#include "mongo/db/jsobj.h"
+#include "mongo/platform/atomic_word.h"
+#include "mongo/util/concurrency/mutex.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        class OplogArchiver;
+
+        /**
+         * The options given to backupStart along with the destination directory.
+         */
+        struct Options {
+            // Keep the backup from evicting the server's working set, see CacheGuard.
+            bool cacheNeutral;
+            // Write a Manifest with per-file checksums once the copy is done.
+            bool manifest;
+            // Archive the oplog from the start of the backup until stopped, see OplogArchiver.
+            bool oplog;
+
+            Options() : cacheNeutral(false), manifest(false), oplog(false) {}
+            bool parse(const BSONObj &cmdObj, string &errmsg);
+            void get(BSONObjBuilder &b) const;
+        };
+
+        /**
+         * One invocation of backupStart, from creation until long after it finishes.  The job
+         * owns the backup's progress and outcome, so backupStatus and backupWait can look at a
+         * job without caring whether its Manager still exists.
+         *
+         * State machine:  pending -> running -> succeeded
+         *                    |          |
+         *                    +----------+----> failed
+         *
+         * A job is pending until the backup library tells us it has actually started copying
+         * (a second concurrent backup is refused by the library and goes straight to failed).
+         */
+        class Job : public boost::enable_shared_from_this<Job>, boost::noncopyable {
+          public:
+            enum State {
+                PENDING,
+                RUNNING,
+                SUCCEEDED,
+                FAILED
+            };
+
+          private:
+            const long long _id;
+            const string _dest;
+            const Options _options;
+            Progress _progress;
+            DeviceStats _devices;
+
+            mutable mongo::mutex _mutex;
+            boost::condition _doneCond;
+            boost::condition _resumeCond;
+            State _state;
+            unsigned long long _startTime;
+            unsigned long long _endTime;
+            string _errmsg;
+            BSONObj _result;
+            shared_ptr<OplogArchiver> _oplogArchiver;
+            // Changed under _mutex, but atomic so the poll callback can check it without locking.
+            AtomicUInt32 _paused;
+            unsigned long long _pausedSince;
+            unsigned long long _pausedMillis;
+            // Set once by cancel(), checked without locking like _paused.
+            AtomicUInt32 _cancelled;
+
+            void _runInThread();
+            void _finish(bool ok, const string &errmsg, const BSONObj &result);
+
+          public:
+            Job(long long id, const string &dest, const Options &options);
+
+            long long id() const { return _id; }
+            const Options &options() const { return _options; }
+            Progress &progress() { return _progress; }
+            DeviceStats &devices() { return _devices; }
+
+            State state() const;
+            bool finished() const;
+            // Whether the job's OplogArchiver, if it has one, is still running.
+            bool archiving() const;
+            static const char *stateName(State state);
+
+            /**
+             * Runs the backup on the calling thread, using c to check for interruption.
+             */
+            bool run(Client &c, string &errmsg, BSONObjBuilder &result);
+
+            /**
+             * Runs the backup on a new thread with its own Client, and returns immediately.  If
+             * the thread can't be started, the job fails and so does launch().
+             */
+            bool launch(string &errmsg);
+
+            /**
+             * Called by the Manager once the backup library has accepted this backup.
+             */
+            void running();
+
+            /**
+             * Pausing holds the library's copy thread in the poll callback until resume().  The
+             * library keeps mirroring the server's writes meanwhile, so the backup stays
+             * consistent and picks up where it stopped.  Both fail once the job has finished.
+             */
+            bool pause(string &errmsg);
+            bool resume(string &errmsg);
+
+            /**
+             * Called from the poll callback: blocks while the job is paused, checking c for
+             * interruption every kPauseCheckMillis.  Returns the interruption message, if any.
+             * Doesn't lock anything unless the job is paused.
+             */
+            string waitWhilePaused(Client &c);
+            static const unsigned long long kPauseCheckMillis = 1000;
+
+            /**
+             * Makes the backup give up at its next poll callback (or checksum read, for the
+             * manifest), like killOp does for a synchronous backup.  Fails once the job has
+             * finished.
+             */
+            bool cancel(string &errmsg);
+
+            /**
+             * Why the backup should stop: it was cancelled, or c was killed.  Empty if it
+             * shouldn't.
+             */
+            string interrupted(Client &c) const;
+
+            void setOplogArchiver(const shared_ptr<OplogArchiver> &archiver);
+            shared_ptr<OplogArchiver> oplogArchiver() const;
+
+            /**
+             * Waits up to timeoutMillis (forever if timeoutMillis <= 0) for the job to finish,
+             * or until c is killed, checking every kWaitCheckMillis.
+             * If it finished, its outcome is reported as if the backup had been run
+             * synchronously.  Otherwise, returns false with errmsg set and "done": false in
+             * result.
+             */
+            bool wait(Client &c, long long timeoutMillis, string &errmsg, BSONObjBuilder &result);
+            static const unsigned long long kWaitCheckMillis = 1000;
+
+            /**
+             * Reports the job's state, timing, progress and throughput, and, once it has
+             * finished, its outcome.
+             */
+            void get(BSONObjBuilder &b) const;
+        };
+
+        /**
+         * Every backup goes through the registry.  It remembers all unfinished jobs (including
+         * those still archiving the oplog) and the last kHistorySize finished ones, and which job
+         * the backup library is currently running.
+         */
+        class JobRegistry {
+            static SimpleMutex _mutex;
+            static long long _nextId;
+            static std::deque<shared_ptr<Job> > _jobs;
+            static shared_ptr<Job> _current;
+
+          public:
+            static const size_t kHistorySize = 10;
+
+            static shared_ptr<Job> create(const string &dest, const Options &options);
+
+            /**
+             * Returns an empty pointer if there's no such job (or it's been forgotten).
+             */
+            static shared_ptr<Job> find(long long id);
+
+            static void setCurrent(const shared_ptr<Job> &job);
+            static void finished(const shared_ptr<Job> &job);
+
+            /**
+             * Reports on job jobId, or if jobId < 0, the running backup, or if there is none,
+             * the most recent one.  With history, also reports every job we remember.
+             */
+            static bool status(long long jobId, bool history, string &errmsg, BSONObjBuilder &result);
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -21,6 +21,7 @@ Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
 
 #include "manager.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <string>
 #include <sys/stat.h>
@@ -30,12 +31,21 @@ Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
 
 #include <backup.h>
 
+#include "cache_guard.h"
+#include "checksum.h"
+#include "job.h"
+#include "manifest.h"
+#include "oplog_archiver.h"
+#include "progress.h"
+#include "throttle.h"
+#include "verifier.h"
+
 #include "mongo/db/client.h"
 #include "mongo/db/jsobj.h"
 #include "mongo/db/kill_current_op.h"
-#include "mongo/util/concurrency/mutex.h"
 #include "mongo/util/debug_util.h"
 #include "mongo/util/log.h"
+#include "mongo/util/time_support.h"
 
 namespace mongo {
 
@@ -44,9 +54,6 @@ namespace mongo {
 
     namespace backup {
 
-        SimpleMutex Manager::_currentMutex("backup manager");
-        Manager *Manager::_currentManager = NULL;
-
         static int c_poll_fun(float progress, const char *progress_string, void *poll_extra) {
             Manager *t = static_cast<Manager *>(poll_extra);
             return t->poll(progress, progress_string);
@@ -56,194 +63,96 @@ namespace mongo {
             t->error(error_number, error_string);
         }
 
-        Manager::~Manager() {
-            SimpleMutex::scoped_lock lk(_currentMutex);
-            if (_currentManager == this) {
-                _currentManager = NULL;
-            }
-        }
+        Manager::Manager(Client &c, Job &job) :
+                _c(c),
+                _job(job),
+                _killedString(),
+                _cacheGuard(),
+                _oplogArchiver(),
+                _oplogStarted(false),
+                _oplogError(),
+                _error()
+        {}
+
+        Manager::~Manager() {}
 
         int Manager::poll(float progress, const char *progress_string) {
-            _killedString = killCurrentOp.checkForInterruptNoAssert(_c);
+            _killedString = _job.interrupted(_c);
             if (!_killedString.empty()) {
                 return -1;
             }
 
-            if (strncmp(progress_string, "Preparing backup", sizeof("Preparing backup")) == 0) {
-                // We won the race (if any), we're the current backup.
-                SimpleMutex::scoped_lock lk(_currentMutex);
-                if (_currentManager != NULL) {
-                    // There's a small possible race condition here.  It's possible that the last
-                    // backup has ended and released its internal lock, but has not yet reached the
-                    // manager's destructor so it is still the value of _currentManager when we
-                    // reach this point.  If that's the case, we don't want to crash so we won't
-                    // assert here.
-                    //verify(_currentManager == NULL);
-
-                    LOG(1) << "A different manager already exists, and we are being polled.  This "
-                           << "should only happen if backups are being done in quick succession." << endl;
-                }
-                _currentManager = this;
+            ProgressRecord record;
+            if (!record.parse(progress_string)) {
+                DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
                 return 0;
             }
 
-            double percentDone = progress * 100.0;
-            stringstream ss;
-            ss << std::setw(6) << std::fixed << std::setprecision(2) << percentDone << "%";
-            LOG(1) << "Backup progress " << ss.str() << endl;
-            LOG(1) << progress_string << endl;
-
-            _progress.parse(progress, progress_string);
-            return 0;
-        }
-
-        void Manager::Progress::parse(float progress, const char *progress_string) {
-            size_t bytesDone;
-            int filesDone;
-            int consumed;
-            const char *p = progress_string;
-            int r = sscanf(p, "Backup progress %zu bytes, %d files. %n", &bytesDone, &filesDone, &consumed);
-            if (r != 2) {
-                DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
-                return;
-            }
-            p += consumed;
-
-            StringData progressString(p);
-            if (progressString.find("more files known of") != string::npos) {
-                // Example:
-                // Backup progress 475607 bytes, 13 files.  4 more files known of. Copying file /__tokumx_loc
-                int filesRemaining;
-                r = sscanf(p, "%d more files known of. Copying file %n", &filesRemaining, &consumed);
-                if (r != 1) {
-                    DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
-                    return;
-                }
-                p += consumed;
-                while (*p == ' ' || *p == '\t') {
-                    ++p;
-                }
-
-                StringData currentFile(p);
-                if (currentFile == ".") {
-                    // Just noting that we're copying the directory, don't need to save this progress.
-                    return;
-                }
+            if (record.phase == ProgressRecord::PREPARING) {
+                // We won the race (if any), we're the backup the library is running.
+                _job.running();
+                return 0;
+            }
 
-                {
-                    SimpleMutex::scoped_lock lk(_mutex);
-                    _progress = progress;
-                    _bytesDone = bytesDone;
-                    _filesDone = filesDone - 1;  // number reported is the current file number, it's not done yet.
-                    _filesTotal = filesDone + filesRemaining;
-                    _currentSource = currentFile.toString();
-                    _currentDest = "";
-                    _currentDone = 0;
-                    _currentTotal = 0;
-                }
+            if (!_startOplogArchiver(_oplogError)) {
+                return -1;
             }
-            else if (progressString.find("Throttled: copied") != string::npos) {
-                // Example:
-                // Backup progress %ld bytes, %ld files.  Throttled: copied %ld/%ld bytes of %s to %s. Sleeping %.2fs for throttling.
-                size_t currentDone;
-                size_t currentTotal;
-                r = sscanf(p, "Throttled: copied %zu/%zu bytes of %n", &currentDone, &currentTotal, &consumed);
-                if (r != 2) {
-                    DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
-                    return;
-                }
-                p += consumed;
-                while (*p == ' ' || *p == '\t') {
-                    ++p;
-                }
 
-                StringData rest(p);
-                size_t toPos = rest.find(" to ");
-                StringData currentSource = rest.substr(0, toPos);
-                StringData currentDest = rest.substr(toPos + 4, rest.size() - 5 - toPos);
+            _killedString = _job.waitWhilePaused(_c);
+            if (!_killedString.empty()) {
+                return -1;
+            }
 
-                size_t sleeping = rest.find(". Sleeping ");
-                p += sleeping + 11;
-                while (*p == ' ' || *p == '\t') {
-                    ++p;
-                }
+            if (logLevel >= 1) {
+                double percentDone = progress * 100.0;
+                stringstream ss;
+                ss << std::setw(6) << std::fixed << std::setprecision(2) << percentDone << "%";
+                LOG(1) << "Backup progress " << ss.str() << endl;
+                LOG(1) << progress_string << endl;
+            }
 
-                float sleepTime;
-                r = sscanf(p, "%fs for throttling.", &sleepTime);
-                if (r != 1) {
-                    DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
-                    return;
-                }
+            if (record.phase == ProgressRecord::DISCOVERED && record.source == ".") {
+                // Just noting that we're copying the directory, don't need to save this progress.
+                return 0;
+            }
 
-                // TODO: maybe report this somewhere?
-                (void) sleepTime;
-
-                {
-                    SimpleMutex::scoped_lock lk(_mutex);
-                    _progress = progress;
-                    _bytesDone = bytesDone;
-                    _filesDone = filesDone - 1;  // number reported is the current file number, it's not done yet.
-                    _currentDone = currentDone;
-                    _currentTotal = currentTotal;
-                    _currentSource = currentSource.toString();
-                    _currentDest = currentDest.toString();
-                }
+            _job.progress().update(progress, record);
+            _job.devices().poll(record);
+            if (_cacheGuard && record.phase != ProgressRecord::DISCOVERED) {
+                _cacheGuard->poll(record.source, record.dest, record.currentDone);
             }
-            else {
-                // Example:
-                // Backup progress 442839 bytes, 10 files.  Copying file: 0/32768 bytes done of /data/db/tokumx.rollback to /data/backup/tokumx.rollback.
-                size_t currentDone;
-                size_t currentTotal;
-                r = sscanf(p, "Copying file: %zu/%zu bytes done of %n", &currentDone, &currentTotal, &consumed);
-                if (r != 2) {
-                    DEV LOG(0) << "Unexpected backup poll message: " << progress_string << endl;
-                    return;
-                }
-                p += consumed;
-                while (*p == ' ' || *p == '\t') {
-                    ++p;
-                }
+            const long long sleepMicros = Throttle::poll(record.bytesDone);
+            if (sleepMicros > 0 && !_sleep(sleepMicros)) {
+                return -1;
+            }
+            return 0;
+        }
 
-                StringData rest(p);
-                size_t toPos = rest.find(" to ");
-                StringData currentSource = rest.substr(0, toPos);
-                StringData currentDest = rest.substr(toPos + 4, rest.size() - 5 - toPos);
-
-                {
-                    SimpleMutex::scoped_lock lk(_mutex);
-                    _progress = progress;
-                    _bytesDone = bytesDone;
-                    _filesDone = filesDone - 1;  // number reported is the current file number, it's not done yet.
-                    _currentDone = currentDone;
-                    _currentTotal = currentTotal;
-                    _currentSource = currentSource.toString();
-                    _currentDest = currentDest.toString();
+        bool Manager::_sleep(long long micros) {
+            // Long sleeps are cut up so a kill doesn't have to wait them out.
+            static const long long kSliceMicros = 100 * 1000;
+            for (long long left = micros; left > 0; left -= kSliceMicros) {
+                sleepmicros(std::min(left, kSliceMicros));
+                _killedString = _job.interrupted(_c);
+                if (!_killedString.empty()) {
+                    return false;
                 }
             }
+            _job.progress().slept(micros);
+            return true;
         }
 
-        void Manager::Progress::get(BSONObjBuilder &b) const {
-            SimpleMutex::scoped_lock lk(_mutex);
-            b.append("percent", _progress * 100.0);
-            b.append("bytesDone", _bytesDone);
-            {
-                BSONObjBuilder fb(b.subobjStart("files"));
-                fb.append("done", _filesDone);
-                fb.append("total", _filesTotal);
-                fb.doneFast();
+        bool Manager::_startOplogArchiver(string &errmsg) {
+            // Started once the library is past PREPARING, since the archive lives in the
+            // destination and the library wants that to be empty when it begins.
+            if (!_oplogArchiver || _oplogStarted) {
+                return true;
             }
-            if (!_currentSource.empty()) {
-                BSONObjBuilder cb(b.subobjStart("current"));
-                cb.append("source", _currentSource);
-                if (!_currentDest.empty()) {
-                    cb.append("dest", _currentDest);
-                    BSONObjBuilder bb(cb.subobjStart("bytes"));
-                    bb.append("done", _currentDone);
-                    bb.append("total", _currentTotal);
-                    bb.doneFast();
-                }
-                cb.doneFast();
+            if (!_oplogArchiver->start(errmsg)) {
+                return false;
             }
+            _oplogStarted = true;
+            return true;
         }
 
         void Manager::error(int error_number, const char *error_string) {
@@ -284,45 +193,67 @@ namespace mongo {
             b.append("strerror", strerror(eno));
         }
 
-        std::vector<string> Manager::_getSourceDirs(const boost::filesystem::path &data_src,
-                                                    const boost::filesystem::path &log_src) {
-            std::string data = data_src.generic_string();
-            std::string log = log_src.generic_string();
-
-            std::vector<string> sources;
-            if (cmdLine.logDir.empty()) {
-                sources.push_back(data);
-                return sources;
+        // Whether p is dir or somewhere under it, comparing whole path components (so /data2 isn't
+        // under /data).  Both must be canonical.
+        static bool isUnder(const boost::filesystem::path &p, const boost::filesystem::path &dir) {
+            boost::filesystem::path::const_iterator pit = p.begin();
+            for (boost::filesystem::path::const_iterator dit = dir.begin(); dit != dir.end(); ++dit, ++pit) {
+                if (pit == p.end() || *pit != *dit) {
+                    return false;
+                }
             }
+            return true;
+        }
 
-            if (equivalent(data_src, log_src)) {
-                sources.push_back(data);
-                return sources;
+        bool Manager::_getSourceDirs(const boost::filesystem::path &data_src,
+                                     const boost::filesystem::path &log_src,
+                                     std::vector<boost::filesystem::path> &sources,
+                                     std::vector<string> &names,
+                                     string &errmsg) {
+            if (cmdLine.logDir.empty() || isUnder(log_src, data_src)) {
+                sources.push_back(data_src);
+                names.push_back("data");
+            } else if (isUnder(data_src, log_src)) {
+                // This would be weird, but we should be consistent.
+                sources.push_back(log_src);
+                names.push_back("log");
+            } else {
+                // We always pass dbpath before logDir, if we're using
+                // two directories.
+                sources.push_back(data_src);
+                names.push_back("data");
+                sources.push_back(log_src);
+                names.push_back("log");
             }
 
-            if (data.size() < log.size()) {
-                // Compare just the prefix of data's length, to see if log
-                // is a subdirectory.
-                if (data.compare(0, data.size(), log) == 0) {
-                    sources.push_back(data);
-                } else {
-                    sources.push_back(data);
-                    sources.push_back(log);
-                }
-            } else {
-                // Check whether data is a subdirectory of log.  This
-                // would be weird, but we should be consistent.
-                if (log.compare(0, log.size(), data) == 0) {
-                    sources.push_back(log);
-                } else {
-                    // We always pass dbpath before logDir, if we're using
-                    // two directories.
-                    sources.push_back(data);
-                    sources.push_back(log);
+            // Databases symlinked out of dbpath (e.g. onto other volumes) are sources of their
+            // own: the library recognizes the files it has to mirror writes to by their resolved
+            // paths, so it would miss writes to them if it only reached them through the link.
+            // The library gives us no way to leave the link out of the dbpath copy, so their data
+            // is copied twice, once through the link; restore keeps only the separate copy.
+            try {
+                for (boost::filesystem::directory_iterator it(data_src), end; it != end; ++it) {
+                    if (!boost::filesystem::is_symlink(it->symlink_status()) ||
+                        !boost::filesystem::is_directory(it->status())) {
+                        continue;
+                    }
+                    const boost::filesystem::path target = canonical(it->path());
+                    bool covered = false;
+                    for (size_t i = 0; i < sources.size() && !covered; ++i) {
+                        covered = isUnder(target, sources[i]) || isUnder(sources[i], target);
+                    }
+                    if (covered) {
+                        LOG(1) << "backup: " << it->path().string() << " resolves into another source directory, not copying it separately" << endl;
+                        continue;
+                    }
+                    sources.push_back(target);
+                    names.push_back(Manifest::kLinkedDirPrefix + it->path().filename().generic_string());
                 }
+            } catch (const boost::filesystem::filesystem_error &e) {
+                errmsg = "could not look for symlinked directories in " + data_src.string() + ": " + e.what();
+                return false;
             }
-
-            return sources;
+            return true;
         }
 
         bool Manager::start(const string &dest, string &errmsg, BSONObjBuilder &result) {
@@ -330,51 +261,71 @@ namespace mongo {
             // for both the data dir and the log dir (if it exists).
             const boost::filesystem::path data_src = canonical(boost::filesystem::path(dbpath));
             const boost::filesystem::path log_src = canonical(boost::filesystem::path(cmdLine.logDir));
-            const std::vector<string> sources = _getSourceDirs(data_src, log_src);
-            verify(!sources.empty());
-            verify(sources.size() <= 2);
+            std::vector<boost::filesystem::path> source_paths;
+            std::vector<string> names;
+            if (!_getSourceDirs(data_src, log_src, source_paths, names, errmsg)) {
+                return false;
+            }
+            verify(!source_paths.empty());
 
+            std::vector<string> sources;
             std::vector<string> dests;
 
-            // Fill in dests vector based on sources.
-            if (sources.size() == 1) {
+            // Fill in dests vector based on sources.  The oplog archive goes next to the copies,
+            // so with one it can't share dest with a copied directory (say, a database "oplog").
+            if (source_paths.size() == 1 && !_job.options().oplog) {
+                sources.push_back(source_paths[0].generic_string());
                 dests.push_back(dest);
             } else {
+                // Otherwise each source dir gets its own subdirectory of dest.
                 const boost::filesystem::path dest_path = dest;
-                // If we have two source dirs, they will be dbpath and
-                // logDir, we need to create subdirectories of dest.
-                const boost::filesystem::path data_dest = dest_path / "data";
-                const boost::filesystem::path log_dest = dest_path / "log";
-                try {
-                    boost::filesystem::create_directory(data_dest);
-                    boost::filesystem::create_directory(log_dest);
-                } catch (const boost::filesystem::filesystem_error &e) {
-                    DEV {
-                        LOG(0) << "ERROR: Hot Backup could not create backup subdirectories:"
-                               << e.what()
-                               << endl;
+                for (size_t i = 0; i < source_paths.size(); ++i) {
+                    const boost::filesystem::path sub_dest = dest_path / names[i];
+                    try {
+                        boost::filesystem::create_directory(sub_dest);
+                    } catch (const boost::filesystem::filesystem_error &e) {
+                        DEV {
+                            LOG(0) << "ERROR: Hot Backup could not create backup subdirectories:"
+                                   << e.what()
+                                   << endl;
+                        }
+                        errmsg = "ERROR: Hot Backup could not create backup subdirectories.";
+                        return false;
                     }
-                    errmsg = "ERROR: Hot Backup could not create backup subdirectories.";
-                    return false;
+                    sources.push_back(source_paths[i].generic_string());
+                    dests.push_back(sub_dest.generic_string());
                 }
-
-                dests.push_back(data_dest.generic_string());
-                dests.push_back(log_dest.generic_string());
             }
-            const char *source_dirs[2];
-            const char *dest_dirs[2];
+            std::vector<const char *> source_dirs;
+            std::vector<const char *> dest_dirs;
             const size_t dir_count = sources.size();
             for (size_t i = 0; i < dir_count; ++i) {
-                source_dirs[i] = sources[i].c_str();
-                dest_dirs[i] = dests[i].c_str();
+                LOG(1) << "backup: copying " << sources[i] << " to " << dests[i] << endl;
+                _job.devices().addSourceDir(sources[i]);
+                source_dirs.push_back(sources[i].c_str());
+                dest_dirs.push_back(dests[i].c_str());
+            }
+
+            if (_job.options().cacheNeutral) {
+                _cacheGuard.reset(new CacheGuard);
+            }
+            if (_job.options().oplog) {
+                _oplogArchiver.reset(new OplogArchiver((boost::filesystem::path(dest) / Manifest::kOplogDirName).generic_string()));
+                if (!_oplogArchiver->mark(errmsg)) {
+                    return false;
+                }
+                _job.setOplogArchiver(_oplogArchiver);
             }
 
             DEV {
                 LOG(0) << "Starting backup on " << dest << endl;
             }
-            int r = tokubackup_create_backup(source_dirs, dest_dirs, dir_count,
+            int r = tokubackup_create_backup(&source_dirs[0], &dest_dirs[0], dir_count,
                                              c_poll_fun, this,
                                              c_error_fun, this);
+            if (_cacheGuard) {
+                _cacheGuard->finish();
+            }
             bool ok = r == 0;
             if (ok && !_error.empty()) {
                 LOG(0) << "backup succeeded but reported an error" << endl;
@@ -386,6 +337,26 @@ namespace mongo {
             if (!ok) {
                 _error.get(result);
             }
+            else {
+                // In case the library never got past PREPARING.
+                ok = _startOplogArchiver(_oplogError);
+            }
+            if (!_oplogError.empty()) {
+                errmsg = "could not start oplog archiving: " + _oplogError;
+                result.append("oplogError", _oplogError);
+            }
+            if (ok && _job.options().manifest) {
+                // The copy is good whatever happens to the manifest, so don't fail the backup.
+                string manifestErrmsg;
+                if (!_writeManifest(dest, sources, dests, manifestErrmsg, result)) {
+                    LOG(0) << "backup of " << dest << " succeeded but its manifest could not be written: "
+                           << manifestErrmsg << endl;
+                    result.append("manifestError", manifestErrmsg);
+                }
+            }
+            if (!ok && _oplogArchiver) {
+                _oplogArchiver->stop();
+            }
 
             if (!_killedString.empty()) {
                 result.append("reason", _killedString);
@@ -394,23 +365,160 @@ namespace mongo {
             return ok;
         }
 
-        bool Manager::throttle(long long bps, string &errmsg, BSONObjBuilder &result) {
-            if (bps < 0) {
-                errmsg = "backupThrottle argument cannot be negative";
+        class Manager::ManifestReader : public ChecksumListener {
+            Manager &_m;
+            long long _bytesDone;
+            const long long _bytesTotal;
+
+          public:
+            ManifestReader(Manager &m, long long bytesTotal) : _m(m), _bytesDone(0), _bytesTotal(bytesTotal) {}
+
+            long long bytesDone() const { return _bytesDone; }
+
+            // Treated like the copy: it can be paused or killed, honors cacheNeutral and the
+            // throttle, and shows up in backupStatus.
+            virtual bool read(const std::string &path, uint64_t done, size_t len) {
+                _bytesDone += len;
+                _m._killedString = _m._job.waitWhilePaused(_m._c);
+                if (_m._killedString.empty()) {
+                    _m._killedString = _m._job.interrupted(_m._c);
+                }
+                if (!_m._killedString.empty()) {
+                    return false;
+                }
+                _m._job.progress().checksumming(path, _bytesDone, _bytesTotal);
+                if (_m._cacheGuard) {
+                    _m._cacheGuard->poll(path, StringData("", 0), done);
+                }
+                const long long sleepMicros = Throttle::pace(_bytesDone);
+                return sleepMicros <= 0 || _m._sleep(sleepMicros);
+            }
+        };
+
+        bool Manager::_writeManifest(const string &root, const std::vector<string> &sources,
+                                     const std::vector<string> &dests, string &errmsg,
+                                     BSONObjBuilder &result) {
+            LOG(0) << "Writing backup manifest for " << root << endl;
+            const unsigned long long startTime = curTimeMillis64();
+
+            Manifest manifest;
+            for (size_t i = 0; i < sources.size(); ++i) {
+                Manifest::Dir d;
+                d.source = sources[i];
+                d.dest = dests[i] == root ? "." : boost::filesystem::path(dests[i]).filename().generic_string();
+                manifest.dirs.push_back(d);
+            }
+            if (_oplogArchiver) {
+                manifest.oplog = Manifest::kOplogDirName;
+            }
+            if (!manifest.list(root, errmsg)) {
+                return false;
+            }
+
+            // The library has let go of the files by now, so this is the first point at which
+            // their contents are final.
+            long long total = 0;
+            for (std::vector<Manifest::File>::const_iterator it = manifest.files.begin(); it != manifest.files.end(); ++it) {
+                total += it->size;
+            }
+            ManifestReader reader(*this, total);
+            std::vector<char> buf(1 << 20);
+            bool ok = true;
+            for (std::vector<Manifest::File>::iterator it = manifest.files.begin(); ok && it != manifest.files.end(); ++it) {
+                ok = checksumFile(manifest.destPath(root, *it), buf, it->size, it->crc32c, errmsg, &reader);
+            }
+            if (_cacheGuard) {
+                _cacheGuard->finish();
+            }
+            if (!ok) {
+                if (!_killedString.empty()) {
+                    errmsg = "interrupted while writing backup manifest: " + _killedString;
+                }
+                return false;
+            }
+            const long long bytes = reader.bytesDone();
+            if (!manifest.write(root, errmsg)) {
                 return false;
             }
-            DEV LOG(0) << "Throttling backup to " << bps << endl;
-            tokubackup_throttle_backup(bps);
+
+            BSONObjBuilder mb(result.subobjStart("manifest"));
+            mb.append("path", root + "/" + Manifest::kFileName);
+            mb.append("files", static_cast<long long>(manifest.files.size()));
+            mb.append("bytes", bytes);
+            mb.append("millis", static_cast<long long>(curTimeMillis64() - startTime));
+            mb.doneFast();
             return true;
         }
 
-        bool Manager::status(string &errmsg, BSONObjBuilder &result) {
-            SimpleMutex::scoped_lock lk(_currentMutex);
-            if (_currentManager == NULL) {
-                errmsg = "no backup running";
+        // Keep the reply well clear of the maximum BSON size even if every file in a huge backup
+        // is bad.
+        static const size_t kMaxProblemsReported = 1000;
+
+        static void appendProblems(BSONObjBuilder &b, const StringData &name, const Manifest &manifest,
+                                   const std::vector<Verifier::Problem> &problems) {
+            BSONArrayBuilder ab(b.subarrayStart(name));
+            for (size_t i = 0; i < problems.size() && i < kMaxProblemsReported; ++i) {
+                const Manifest::File &f = manifest.files[problems[i].file];
+                const string &dir = manifest.dirs[f.dir].dest;
+                BSONObjBuilder pb(ab.subobjStart());
+                pb.append("file", dir == "." ? f.path : dir + "/" + f.path);
+                pb.append("problem", problems[i].what);
+                pb.doneFast();
+            }
+            ab.doneFast();
+        }
+
+        bool Manager::verifyBackup(Client &c, const string &root, size_t threads, string &errmsg, BSONObjBuilder &result) {
+            Manifest manifest;
+            if (!manifest.read(root, errmsg)) {
+                return false;
+            }
+
+            const unsigned long long startTime = curTimeMillis64();
+            Verifier verifier(manifest, root);
+            if (!verifier.start(threads, errmsg)) {
                 return false;
             }
-            _currentManager->_progress.get(result);
+            while (!verifier.wait(100)) {
+                const string killedString = killCurrentOp.checkForInterruptNoAssert(c);
+                if (!killedString.empty()) {
+                    // The threads stop at their next read, the verifier's destructor waits for them.
+                    verifier.abort();
+                    errmsg = "interrupted while verifying backup";
+                    result.append("reason", killedString);
+                    return false;
+                }
+            }
+            const unsigned long long elapsed = curTimeMillis64() - startTime;
+
+            const size_t problems = verifier.missing().size() + verifier.mismatched().size() + verifier.errors().size() +
+                    verifier.unexpected().size();
+            result.appendBool("valid", problems == 0);
+            result.append("threads", static_cast<int>(threads));
+            {
+                BSONObjBuilder fb(result.subobjStart("files"));
+                fb.append("checked", static_cast<long long>(verifier.filesDone()));
+                fb.append("missing", static_cast<long long>(verifier.missing().size()));
+                fb.append("mismatched", static_cast<long long>(verifier.mismatched().size()));
+                fb.append("errors", static_cast<long long>(verifier.errors().size()));
+                fb.append("unexpected", static_cast<long long>(verifier.unexpected().size()));
+                fb.doneFast();
+            }
+            result.append("bytes", static_cast<long long>(verifier.bytesDone()));
+            result.append("millis", static_cast<long long>(elapsed));
+            if (elapsed > 0) {
+                result.append("bytesPerSec", static_cast<long long>(verifier.bytesDone() * 1000 / elapsed));
+            }
+            if (problems > 0) {
+                appendProblems(result, "missing", manifest, verifier.missing());
+                appendProblems(result, "mismatched", manifest, verifier.mismatched());
+                appendProblems(result, "errors", manifest, verifier.errors());
+                BSONArrayBuilder ub(result.subarrayStart("unexpected"));
+                for (size_t i = 0; i < verifier.unexpected().size() && i < kMaxProblemsReported; ++i) {
+                    ub.append(verifier.unexpected()[i]);
+                }
+                ub.doneFast();
+            }
             return true;
         }
 
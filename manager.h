@@ -23,44 +23,27 @@ Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
 #include "mongo/pch.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "mongo/db/client.h"
 #include "mongo/db/jsobj.h"
-#include "mongo/util/concurrency/mutex.h"
 
 namespace mongo {
 
     namespace backup {
 
+        class CacheGuard;
+        class Job;
+        class OplogArchiver;
+
         class Manager : boost::noncopyable {
             Client &_c;
+            Job &_job;
             string _killedString;
-
-            class Progress {
-                mutable SimpleMutex _mutex;
-                float _progress;
-                long long _bytesDone;
-                int _filesDone;
-                int _filesTotal;
-                long long _currentDone;
-                long long _currentTotal;
-                string _currentSource;
-                string _currentDest;
-              public:
-                Progress() :
-                        _mutex("backup progress"),
-                        _progress(0.0),
-                        _bytesDone(0),
-                        _filesDone(0),
-                        _filesTotal(0),
-                        _currentDone(0),
-                        _currentTotal(0),
-                        _currentSource(),
-                        _currentDest()
-                {}
-                void parse(float progress, const char *progress_string);
-                void get(BSONObjBuilder &b) const;
-            } _progress;
+            boost::scoped_ptr<CacheGuard> _cacheGuard;
+            shared_ptr<OplogArchiver> _oplogArchiver;
+            bool _oplogStarted;
+            string _oplogError;
 
             struct Error {
                 // errno, but avoid shadowing
@@ -72,14 +55,35 @@ namespace mongo {
                 void get(BSONObjBuilder &b) const;
             } _error;
 
-            static SimpleMutex _currentMutex;
-            static Manager *_currentManager;
-
-            static std::vector<string> _getSourceDirs(const boost::filesystem::path &data_src,
-                                                      const boost::filesystem::path &log_src);
+            /**
+             * Fills in the canonical source directories to back up and, for each, the name of its
+             * subdirectory of the destination (only used if there's more than one): dbpath as
+             * "data", logDir as "log" unless it's under dbpath, and every directory symlinked
+             * from the top of dbpath to outside those as Manifest::kLinkedDirPrefix + its name.
+             * Fails if dbpath can't be scanned for such links, since the backup would silently
+             * miss them.
+             */
+            static bool _getSourceDirs(const boost::filesystem::path &data_src,
+                                       const boost::filesystem::path &log_src,
+                                       std::vector<boost::filesystem::path> &sources,
+                                       std::vector<string> &names,
+                                       string &errmsg);
+
+            // Paces and reports on the checksum pass for _writeManifest.
+            class ManifestReader;
+            friend class ManifestReader;
+
+            bool _writeManifest(const string &root, const std::vector<string> &sources,
+                                const std::vector<string> &dests, string &errmsg,
+                                BSONObjBuilder &result);
+
+            bool _startOplogArchiver(string &errmsg);
+
+            // Sleeps for the throttle, returns false if interrupted.
+            bool _sleep(long long micros);
 
           public:
-            explicit Manager(Client &c) : _c(c), _killedString(), _progress(), _error() {}
+            Manager(Client &c, Job &job);
             ~Manager();
 
             int poll(float progress, const char *progress_string);
@@ -88,9 +92,11 @@ namespace mongo {
 
             bool start(const string &dest, string &errmsg, BSONObjBuilder &result);
 
-            static bool throttle(long long bps, string &errmsg, BSONObjBuilder &result);
-
-            static bool status(string &errmsg, BSONObjBuilder &result);
+            /**
+             * Checks the backup in root against its manifest, reading files on the given number
+             * of threads.
+             */
+            static bool verifyBackup(Client &c, const string &root, size_t threads, string &errmsg, BSONObjBuilder &result);
         };
 
     } // namespace backup
@@ -0,0 +1,222 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file manifest.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "manifest.h"
+
+#include <errno.h>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+namespace mongo {
+
+    namespace backup {
+
+        const char *const Manifest::kFileName = "backup.manifest";
+        const char *const Manifest::kOplogDirName = "oplog";
+        const char *const Manifest::kLinkedDirPrefix = "data.";
+
+        static const char kHeader[] = "tokumx-backup-manifest 1";
+
+        static std::string escape(const std::string &s) {
+            std::string out;
+            out.reserve(s.size());
+            for (std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+                switch (*it) {
+                case '\\': out += "\\\\"; break;
+                case '\t': out += "\\t"; break;
+                case '\n': out += "\\n"; break;
+                default: out += *it; break;
+                }
+            }
+            return out;
+        }
+
+        static bool unescape(const std::string &s, std::string &out) {
+            out.clear();
+            for (size_t i = 0; i < s.size(); ++i) {
+                if (s[i] != '\\') {
+                    out += s[i];
+                    continue;
+                }
+                if (++i == s.size()) {
+                    return false;
+                }
+                switch (s[i]) {
+                case '\\': out += '\\'; break;
+                case 't': out += '\t'; break;
+                case 'n': out += '\n'; break;
+                default: return false;
+                }
+            }
+            return true;
+        }
+
+        static void split(const std::string &line, std::vector<std::string> &fields) {
+            fields.clear();
+            size_t start = 0;
+            for (;;) {
+                size_t tab = line.find('\t', start);
+                fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+                if (tab == std::string::npos) {
+                    return;
+                }
+                start = tab + 1;
+            }
+        }
+
+        std::string Manifest::destPath(const std::string &root, const File &f) const {
+            const std::string &dest = dirs[f.dir].dest;
+            return dest == "." ? root + "/" + f.path : root + "/" + dest + "/" + f.path;
+        }
+
+        std::string Manifest::sourcePath(const File &f) const {
+            return dirs[f.dir].source + "/" + f.path;
+        }
+
+        bool Manifest::list(const std::string &root, std::string &errmsg) {
+            namespace fs = boost::filesystem;
+            files.clear();
+            try {
+                for (size_t i = 0; i < dirs.size(); ++i) {
+                    const fs::path dir = dirs[i].dest == "." ? fs::path(root) : fs::path(root) / dirs[i].dest;
+                    const std::string prefix = dir.generic_string() + "/";
+                    for (fs::recursive_directory_iterator it(dir), end; it != end; ++it) {
+                        if (!oplog.empty() && it->path() == fs::path(root) / oplog) {
+                            it.no_push();
+                            continue;
+                        }
+                        if (!fs::is_regular_file(it->symlink_status())) {
+                            continue;
+                        }
+                        std::string path = it->path().generic_string();
+                        if (path.compare(0, prefix.size(), prefix) != 0) {
+                            continue;
+                        }
+                        path.erase(0, prefix.size());
+                        if (dirs[i].dest == "." && path.compare(0, strlen(kFileName), kFileName) == 0) {
+                            // Ourselves, or our temp file.
+                            continue;
+                        }
+                        File f;
+                        f.dir = i;
+                        f.path = path;
+                        f.size = fs::file_size(it->path());
+                        f.crc32c = 0;
+                        files.push_back(f);
+                    }
+                }
+            } catch (const fs::filesystem_error &e) {
+                errmsg = std::string("could not list backup files: ") + e.what();
+                return false;
+            }
+            return true;
+        }
+
+        bool Manifest::write(const std::string &root, std::string &errmsg) const {
+            const std::string path = root + "/" + kFileName;
+            const std::string tmp = path + ".tmp";
+            FILE *fp = fopen(tmp.c_str(), "w");
+            if (fp == NULL) {
+                errmsg = "could not create " + tmp + ": " + strerror(errno);
+                return false;
+            }
+            fprintf(fp, "%s\n", kHeader);
+            for (std::vector<Dir>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+                fprintf(fp, "dir\t%s\t%s\n", escape(it->dest).c_str(), escape(it->source).c_str());
+            }
+            if (!oplog.empty()) {
+                fprintf(fp, "oplog\t%s\n", escape(oplog).c_str());
+            }
+            for (std::vector<File>::const_iterator it = files.begin(); it != files.end(); ++it) {
+                fprintf(fp, "file\t%zu\t%llu\t%08x\t%s\n", it->dir,
+                        static_cast<unsigned long long>(it->size), it->crc32c, escape(it->path).c_str());
+            }
+            bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+            ok = (fclose(fp) == 0) && ok;
+            if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+                errmsg = "could not write " + path + ": " + strerror(errno);
+                unlink(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        bool Manifest::read(const std::string &root, std::string &errmsg) {
+            const std::string path = root + "/" + kFileName;
+            std::ifstream in(path.c_str());
+            if (!in) {
+                errmsg = "could not open " + path;
+                return false;
+            }
+            dirs.clear();
+            oplog.clear();
+            files.clear();
+
+            std::string line;
+            if (!std::getline(in, line) || line != kHeader) {
+                errmsg = path + " is not a backup manifest";
+                return false;
+            }
+            std::vector<std::string> fields;
+            size_t lineno = 1;
+            while (std::getline(in, line)) {
+                ++lineno;
+                split(line, fields);
+                bool ok = false;
+                if (fields[0] == "dir" && fields.size() == 3) {
+                    Dir d;
+                    ok = unescape(fields[1], d.dest) && unescape(fields[2], d.source);
+                    if (ok) {
+                        dirs.push_back(d);
+                    }
+                }
+                else if (fields[0] == "oplog" && fields.size() == 2) {
+                    ok = unescape(fields[1], oplog);
+                }
+                else if (fields[0] == "file" && fields.size() == 5) {
+                    File f;
+                    char *end;
+                    f.dir = strtoul(fields[1].c_str(), &end, 10);
+                    ok = *end == '\0' && f.dir < dirs.size();
+                    f.size = strtoull(fields[2].c_str(), &end, 10);
+                    ok = ok && *end == '\0';
+                    f.crc32c = strtoul(fields[3].c_str(), &end, 16);
+                    ok = ok && *end == '\0' && unescape(fields[4], f.path);
+                    if (ok) {
+                        files.push_back(f);
+                    }
+                }
+                if (!ok) {
+                    char buf[32];
+                    snprintf(buf, sizeof buf, "%zu", lineno);
+                    errmsg = path + ": malformed line " + buf;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,92 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file manifest.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// This file is shared with the offline restore tool, so it only depends on the standard library
+// and boost.
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * What a backup contains: the source directories that were backed up and where each one
+         * went under the backup root, and every file with its size and CRC32C.
+         *
+         * It's stored as text at <root>/backup.manifest, one record per line:
+         *
+         *     tokumx-backup-manifest 1
+         *     dir   <dest relative to root>   <source>
+         *     oplog <oplog archive directory relative to root>   (only if one was taken)
+         *     file  <dir index>   <size>   <crc32c, hex>   <path relative to dir>
+         *
+         * with fields separated by tabs, and backslash, tab and newline in paths escaped as
+         * \\, \t and \n.
+         */
+        struct Manifest {
+            struct Dir {
+                std::string dest;
+                std::string source;
+            };
+            struct File {
+                size_t dir;
+                std::string path;
+                uint64_t size;
+                uint32_t crc32c;
+            };
+
+            std::vector<Dir> dirs;
+            // Where the OplogArchiver wrote, or empty if the oplog wasn't archived.
+            std::string oplog;
+            std::vector<File> files;
+
+            static const char *const kFileName;
+            // Where an OplogArchiver keeps its segments under the root.  It's not part of the
+            // copy and is still being written after the backup finishes, so it's left out.  A
+            // backup with an archive always puts its copies in subdirectories, so this can't be
+            // a database's directory.
+            static const char *const kOplogDirName;
+            // Prefix of the subdirectory holding a directory symlinked out of dbpath, followed by
+            // the link's name; it's restored to dbpath/<name>.
+            static const char *const kLinkedDirPrefix;
+
+            std::string destPath(const std::string &root, const File &f) const;
+            std::string sourcePath(const File &f) const;
+
+            /**
+             * Fills in files with every regular file under each of dirs' destinations, except
+             * the oplog archive if there is one, with sizes but without checksums.
+             */
+            bool list(const std::string &root, std::string &errmsg);
+
+            bool write(const std::string &root, std::string &errmsg) const;
+            bool read(const std::string &root, std::string &errmsg);
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,382 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file oplog_archiver.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "oplog_archiver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "mongo/client/dbclientcursor.h"
+#include "mongo/db/client.h"
+#include "mongo/db/gtid.h"
+#include "mongo/db/instance.h"
+#include "mongo/db/jsobj.h"
+#include "mongo/db/kill_current_op.h"
+#include "mongo/db/repl.h"
+#include "mongo/db/repl/rs.h"
+#include "mongo/util/compress.h"
+#include "mongo/util/concurrency/mutex.h"
+#include "mongo/util/log.h"
+#include "mongo/util/time_support.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        static const char kOplogNs[] = "local.oplog.rs";
+        static const char kOplogRefsNs[] = "local.oplog.refs";
+
+        // { _id: <GTID> } for the oldest transaction that may not have committed yet.  Every
+        // oplog entry below it is final.
+        static bool minLiveGTID(BSONObj &out, string &errmsg) {
+            if (!theReplSet) {
+                errmsg = "cannot archive the oplog: not running with --replSet";
+                return false;
+            }
+            BSONObjBuilder b;
+            addGTIDToBSON("_id", theReplSet->gtidManager->getMinLiveGTID(), b);
+            out = b.obj();
+            return true;
+        }
+
+        OplogArchiver::OplogArchiver(const string &dir) :
+                _dir(dir),
+                _startAt(),
+                _mutex("backup oplog archiver"),
+                _stopCond(),
+                _stopping(false),
+                _running(false),
+                _error(),
+                _segments(0),
+                _entries(0),
+                _refs(0),
+                _bytes(0),
+                _compressedBytes(0),
+                _lastTs(0),
+                _thread(),
+                _segment(),
+                _segmentOpened(0),
+                _segmentFirstTs(0),
+                _segmentLastTs(0)
+        {}
+
+        OplogArchiver::~OplogArchiver() {
+            stop();
+        }
+
+        bool OplogArchiver::mark(string &errmsg) {
+            return minLiveGTID(_startAt, errmsg);
+        }
+
+        bool OplogArchiver::start(string &errmsg) {
+            verify(!_startAt.isEmpty());
+            mongo::mutex::scoped_lock lk(_mutex);
+            if (_thread || _stopping) {
+                return true;
+            }
+
+            try {
+                boost::filesystem::create_directories(_dir);
+            } catch (const boost::filesystem::filesystem_error &e) {
+                errmsg = string("cannot create oplog archive directory: ") + e.what();
+                return false;
+            }
+
+            _running = true;
+            _thread.reset(new boost::thread(boost::bind(&OplogArchiver::_run, this)));
+            return true;
+        }
+
+        void OplogArchiver::stop() {
+            // backupOplogStop, a failed backup and the destructor can all get here at once, so
+            // only one of them takes the thread to join.
+            boost::scoped_ptr<boost::thread> thread;
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                _stopping = true;
+                thread.swap(_thread);
+            }
+            _stopCond.notify_all();
+            if (thread) {
+                thread->join();
+            }
+        }
+
+        bool OplogArchiver::running() const {
+            mongo::mutex::scoped_lock lk(_mutex);
+            return _running;
+        }
+
+        bool OplogArchiver::_shouldStop(unsigned long long waitMillis) {
+            if (!killCurrentOp.checkForInterruptNoAssert().empty()) {
+                return true;
+            }
+            mongo::mutex::scoped_lock lk(_mutex);
+            if (!_stopping && waitMillis > 0) {
+                _stopCond.timed_wait(lk.boost(), boost::posix_time::milliseconds(waitMillis));
+            }
+            return _stopping;
+        }
+
+        void OplogArchiver::_run() {
+            Client::initThread("backup oplog archiver");
+            // Like the replication threads, so we can read the oplog on a server with --auth.
+            replLocalAuth();
+
+            string errmsg;
+            bool ok = _tail(errmsg);
+            if (!_segment.empty()) {
+                // Keep what we have even if we stopped on an error.
+                string closeErrmsg;
+                if (!_closeSegment(closeErrmsg) && ok) {
+                    ok = false;
+                    errmsg = closeErrmsg;
+                }
+            }
+            if (!ok) {
+                LOG(0) << "backup oplog archiving to " << _dir << " stopped: " << errmsg << endl;
+            }
+
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                _running = false;
+                _error = errmsg;
+            }
+            cc().shutdown();
+        }
+
+        bool OplogArchiver::_tail(string &errmsg) {
+            DBDirectClient conn;
+            BSONObj last;
+            while (!_shouldStop(0)) {
+                BSONObj bound;
+                if (!minLiveGTID(bound, errmsg)) {
+                    return false;
+                }
+
+                BSONObjBuilder qb;
+                {
+                    BSONObjBuilder range(qb.subobjStart("_id"));
+                    if (last.isEmpty()) {
+                        range.appendAs(_startAt.firstElement(), "$gte");
+                    }
+                    else {
+                        range.appendAs(last.firstElement(), "$gt");
+                    }
+                    range.appendAs(bound.firstElement(), "$lt");
+                    range.doneFast();
+                }
+                std::auto_ptr<DBClientCursor> cursor = conn.query(kOplogNs, Query(qb.obj()).sort(BSON("_id" << 1)));
+                if (!cursor.get()) {
+                    errmsg = "could not query the oplog";
+                    return false;
+                }
+
+                bool found = false;
+                while (cursor->more()) {
+                    BSONObj entry = cursor->next();
+                    BSONElement ref = entry["ref"];
+                    if (!ref.eoo() && !_appendRefs(conn, ref, errmsg)) {
+                        return false;
+                    }
+                    if (!_append(entry, errmsg)) {
+                        return false;
+                    }
+                    last = BSON("_id" << entry["_id"]).getOwned();
+                    found = true;
+                    if (_shouldStop(0)) {
+                        return true;
+                    }
+                }
+
+                if (!found) {
+                    // Caught up.  Don't let a quiet period hold a segment open.
+                    if (!_segment.empty() && curTimeMillis64() >= _segmentOpened + kSegmentMillis) {
+                        if (!_closeSegment(errmsg)) {
+                            return false;
+                        }
+                    }
+                    if (_shouldStop(100)) {
+                        return true;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool OplogArchiver::_appendRefs(DBClientBase &conn, const BSONElement &ref, string &errmsg) {
+            // Same lookup as replication does when it applies a ref entry: the documents for a
+            // ref are { _id: { oid: <ref>, seq: <N> }, ops: [ ... ] }, in seq order.
+            BSONObjBuilder qb;
+            {
+                BSONObjBuilder range(qb.subobjStart("_id"));
+                BSONObjBuilder start(range.subobjStart("$gte"));
+                start.appendAs(ref, "oid");
+                start.append("seq", 0LL);
+                start.doneFast();
+                range.doneFast();
+            }
+            std::auto_ptr<DBClientCursor> cursor = conn.query(kOplogRefsNs, Query(qb.obj()).hint(BSON("_id" << 1)));
+            if (!cursor.get()) {
+                errmsg = "could not query local.oplog.refs";
+                return false;
+            }
+            long long n = 0;
+            while (cursor->more()) {
+                BSONObj doc = cursor->next();
+                if (doc["_id"].type() != Object || doc["_id"].Obj()["oid"].woCompare(ref, false) != 0) {
+                    break;
+                }
+                _appendDoc(doc);
+                ++n;
+            }
+            if (n == 0) {
+                errmsg = "oplog entry refers to " + ref.toString(false) + " but local.oplog.refs has nothing for it";
+                return false;
+            }
+            mongo::mutex::scoped_lock lk(_mutex);
+            _refs += n;
+            return true;
+        }
+
+        void OplogArchiver::_appendDoc(const BSONObj &doc) {
+            if (_segment.empty()) {
+                _segmentOpened = curTimeMillis64();
+                _segmentFirstTs = 0;
+            }
+            _segment.append(doc.objdata(), doc.objsize());
+            mongo::mutex::scoped_lock lk(_mutex);
+            _bytes += doc.objsize();
+        }
+
+        bool OplogArchiver::_append(const BSONObj &entry, string &errmsg) {
+            BSONElement tsElt = entry["ts"];
+            const unsigned long long ts = tsElt.type() == Date ? tsElt.date().millis : 0;
+
+            _appendDoc(entry);
+            if (_segmentFirstTs == 0) {
+                _segmentFirstTs = ts;
+            }
+            _segmentLastTs = ts;
+            {
+                mongo::mutex::scoped_lock lk(_mutex);
+                ++_entries;
+                _lastTs = ts;
+            }
+
+            if (static_cast<long long>(_segment.size()) >= kSegmentBytes ||
+                curTimeMillis64() >= _segmentOpened + kSegmentMillis) {
+                return _closeSegment(errmsg);
+            }
+            return true;
+        }
+
+        static bool writeAll(int fd, const string &data) {
+            const char *p = data.data();
+            size_t left = data.size();
+            while (left > 0) {
+                ssize_t n = write(fd, p, left);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                p += n;
+                left -= n;
+            }
+            return true;
+        }
+
+        bool OplogArchiver::_closeSegment(string &errmsg) {
+            if (_segment.empty()) {
+                return true;
+            }
+            string compressed;
+            compress(_segment.data(), _segment.size(), &compressed);
+
+            char name[32];
+            snprintf(name, sizeof name, "%08lld.tmp", _segments);
+            const string tmpPath = _dir + "/" + name;
+            int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                errmsg = "could not create " + tmpPath + ": " + errnoWithDescription();
+                return false;
+            }
+            bool ok = writeAll(fd, compressed);
+            if (!ok) {
+                errmsg = "could not write " + tmpPath + ": " + errnoWithDescription();
+            }
+            else if (fsync(fd) != 0) {
+                ok = false;
+                errmsg = "could not sync " + tmpPath + ": " + errnoWithDescription();
+            }
+            close(fd);
+            if (!ok) {
+                return false;
+            }
+
+            char finalName[80];
+            snprintf(finalName, sizeof finalName, "%08lld-%llu-%llu.bson.snappy", _segments, _segmentFirstTs, _segmentLastTs);
+            const string path = _dir + "/" + finalName;
+            if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+                errmsg = "could not rename " + tmpPath + " to " + path + ": " + errnoWithDescription();
+                return false;
+            }
+            int dirfd = open(_dir.c_str(), O_RDONLY);
+            if (dirfd >= 0) {
+                fsync(dirfd);
+                close(dirfd);
+            }
+            _segment.clear();
+
+            mongo::mutex::scoped_lock lk(_mutex);
+            ++_segments;
+            _compressedBytes += compressed.size();
+            return true;
+        }
+
+        void OplogArchiver::get(BSONObjBuilder &b) const {
+            mongo::mutex::scoped_lock lk(_mutex);
+            b.append("dir", _dir);
+            b.appendBool("running", _running);
+            b.append("segments", _segments);
+            b.append("entries", _entries);
+            b.append("refs", _refs);
+            b.append("bytes", _bytes);
+            b.append("compressedBytes", _compressedBytes);
+            if (_lastTs != 0) {
+                b.appendDate("lastTs", Date_t(_lastTs));
+            }
+            if (!_error.empty()) {
+                b.append("errmsg", _error);
+            }
+        }
+
+    } // namespace backup
+
+} // namespace mongo
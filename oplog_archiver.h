@@ -0,0 +1,128 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file oplog_archiver.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "mongo/db/jsobj.h"
+#include "mongo/util/concurrency/mutex.h"
+
+namespace mongo {
+
+    class DBClientBase;
+
+    namespace backup {
+
+        /**
+         * Archives the oplog alongside a backup, for point-in-time recovery.
+         *
+         * mark() notes the oplog's minimum live GTID before the backup begins, and start()
+         * launches a thread that follows local.oplog.rs from there and appends every entry to
+         * segment files under the archive directory.  start() may come later than mark() (the
+         * archive directory lives inside the backup, which the library wants to find empty);
+         * the thread still picks up at the marked GTID.  Since the backup's consistency point is
+         * reached some time after mark(), the archive always overlaps it: a restore rolls
+         * forward by applying the archived entries whose _id is past the newest one in the
+         * restored oplog, up to the chosen time.
+         *
+         * Transactions can commit out of GTID order, so an entry can show up in the oplog after
+         * one with a higher GTID.  Like replication, the archiver only reads entries below the
+         * minimum live GTID, all of which have committed, so none are skipped.  Entries for large
+         * transactions keep their operations in local.oplog.refs and carry a "ref" instead; each
+         * such entry is preceded in the segment by its local.oplog.refs documents, unchanged, so
+         * it can be applied from the archive alone.
+         *
+         * A segment is closed after kSegmentBytes (uncompressed) or kSegmentMillis, whichever
+         * comes first, compressed with snappy as a single block, and written and fsynced under a
+         * temporary name before being renamed to its final name,
+         * <seq>-<first ts>-<last ts>.bson.snappy (ts in ms since the epoch), so anything with
+         * that name is complete.  Uncompressed, a segment is concatenated BSON documents.
+         *
+         * The archiver runs until stop(), until the server shuts down, or until it hits an error.
+         */
+        class OplogArchiver : boost::noncopyable {
+            const string _dir;
+            // { _id: <GTID> }, the first entry we may need.
+            BSONObj _startAt;
+
+            mutable mongo::mutex _mutex;
+            boost::condition _stopCond;
+            bool _stopping;
+            bool _running;
+            string _error;
+            long long _segments;
+            long long _entries;
+            long long _refs;
+            long long _bytes;
+            long long _compressedBytes;
+            unsigned long long _lastTs;
+            boost::scoped_ptr<boost::thread> _thread;
+
+            // Only touched by the archiver thread.
+            string _segment;
+            unsigned long long _segmentOpened;
+            unsigned long long _segmentFirstTs;
+            unsigned long long _segmentLastTs;
+
+            void _run();
+            bool _tail(string &errmsg);
+            bool _appendRefs(DBClientBase &conn, const BSONElement &ref, string &errmsg);
+            bool _append(const BSONObj &entry, string &errmsg);
+            void _appendDoc(const BSONObj &doc);
+            bool _closeSegment(string &errmsg);
+            bool _shouldStop(unsigned long long waitMillis);
+
+          public:
+            static const long long kSegmentBytes = 16 << 20;
+            static const unsigned long long kSegmentMillis = 10 * 1000;
+
+            explicit OplogArchiver(const string &dir);
+            ~OplogArchiver();
+
+            /**
+             * Must be called on a thread with a Client.
+             */
+            bool mark(string &errmsg);
+
+            /**
+             * Creates the archive directory and starts tailing from the marked entry.  Does
+             * nothing if already started.
+             */
+            bool start(string &errmsg);
+
+            /**
+             * Closes the current segment and waits for the archiver thread to exit.
+             */
+            void stop();
+
+            bool running() const;
+
+            void get(BSONObjBuilder &b) const;
+        };
+
+    } // namespace backup
+
+} // namespace mongo
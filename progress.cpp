@@ -0,0 +1,308 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file progress.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "progress.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "mongo/base/string_data.h"
+#include "mongo/db/jsobj.h"
+#include "mongo/util/time_support.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        // Helpers for decoding the backup library's progress strings in one pass.  Like
+        // sscanf, a space in a literal matches any run of whitespace (including none).
+
+        static inline void skipSpace(const char *&p) {
+            while (*p == ' ' || *p == '\t') {
+                ++p;
+            }
+        }
+
+        template<size_t N>
+        static inline bool consume(const char *&p, const char (&lit)[N]) {
+            const char *q = p;
+            for (size_t i = 0; i < N - 1; ++i) {
+                if (lit[i] == ' ') {
+                    skipSpace(q);
+                }
+                else if (*q++ != lit[i]) {
+                    return false;
+                }
+            }
+            p = q;
+            return true;
+        }
+
+        template<typename T>
+        static inline bool consumeNumber(const char *&p, T &v) {
+            if (*p < '0' || *p > '9') {
+                return false;
+            }
+            long long n = 0;
+            while (*p >= '0' && *p <= '9') {
+                n = n * 10 + (*p++ - '0');
+            }
+            v = static_cast<T>(n);
+            return true;
+        }
+
+        template<size_t N>
+        static inline const char *findLiteral(const char *begin, const char *end, const char (&lit)[N]) {
+            const char *found = std::search(begin, end, lit, lit + N - 1);
+            return found == end ? NULL : found;
+        }
+
+        bool ProgressRecord::parse(const char *progress_string) {
+            const char *p = progress_string;
+            if (consume(p, "Preparing backup") && *p == '\0') {
+                phase = PREPARING;
+                return true;
+            }
+
+            p = progress_string;
+            if (!consume(p, "Backup progress ") || !consumeNumber(p, bytesDone) ||
+                !consume(p, " bytes, ") || !consumeNumber(p, filesDone) ||
+                !consume(p, " files. ")) {
+                return false;
+            }
+
+            if (consume(p, "Copying file: ")) {
+                // Example:
+                // Backup progress 442839 bytes, 10 files.  Copying file: 0/32768 bytes done of /data/db/tokumx.rollback to /data/backup/tokumx.rollback.
+                if (!consumeNumber(p, currentDone) || !consume(p, "/") ||
+                    !consumeNumber(p, currentTotal) || !consume(p, " bytes done of ")) {
+                    return false;
+                }
+                const char *end = p + strlen(p);
+                const char *to = findLiteral(p, end, " to ");
+                if (to == NULL) {
+                    return false;
+                }
+                if (end > to + 4 && end[-1] == '.') {
+                    --end;
+                }
+                source = StringData(p, to - p);
+                dest = StringData(to + 4, end - (to + 4));
+                phase = COPYING;
+                return true;
+            }
+
+            if (consume(p, "Throttled: copied ")) {
+                // Example:
+                // Backup progress %ld bytes, %ld files.  Throttled: copied %ld/%ld bytes of %s to %s. Sleeping %.2fs for throttling.
+                if (!consumeNumber(p, currentDone) || !consume(p, "/") ||
+                    !consumeNumber(p, currentTotal) || !consume(p, " bytes of ")) {
+                    return false;
+                }
+                const char *end = p + strlen(p);
+                const char *to = findLiteral(p, end, " to ");
+                const char *sleeping = to == NULL ? NULL : findLiteral(to, end, ". Sleeping ");
+                if (sleeping == NULL) {
+                    return false;
+                }
+                source = StringData(p, to - p);
+                dest = StringData(to + 4, sleeping - (to + 4));
+                p = sleeping;
+                consume(p, ". Sleeping ");
+                char *sleepEnd;
+                sleepTime = strtod(p, &sleepEnd);
+                if (sleepEnd == p) {
+                    return false;
+                }
+                phase = THROTTLED;
+                return true;
+            }
+
+            // Example:
+            // Backup progress 475607 bytes, 13 files.  4 more files known of. Copying file /__tokumx_loc
+            if (!consumeNumber(p, filesRemaining) || !consume(p, " more files known of. Copying file ")) {
+                return false;
+            }
+            source = StringData(p);
+            phase = DISCOVERED;
+            return true;
+        }
+
+        // Only the backup thread writes, so we don't need to lock against other writers.
+        void Progress::update(float progress, const ProgressRecord &record) {
+            const unsigned seq = _lock.beginWrite();
+
+            Snapshot &s = _snapshot;
+            s.progress = progress;
+            s.bytesDone = record.bytesDone;
+            s.filesDone = record.filesDone - 1;  // number reported is the current file number, it's not done yet.
+            s.sourceLen = std::min(record.source.size(), sizeof s.source);
+            memcpy(s.source, record.source.rawData(), s.sourceLen);
+            if (record.phase == ProgressRecord::DISCOVERED) {
+                s.filesTotal = record.filesDone + record.filesRemaining;
+                s.destLen = 0;
+                s.currentDone = 0;
+                s.currentTotal = 0;
+            }
+            else {
+                if (record.phase == ProgressRecord::THROTTLED) {
+                    // Reported just before the library sleeps.
+                    s.librarySleepMicros += static_cast<long long>(record.sleepTime * 1000000);
+                }
+                s.destLen = std::min(record.dest.size(), sizeof s.dest);
+                memcpy(s.dest, record.dest.rawData(), s.destLen);
+                s.currentDone = record.currentDone;
+                s.currentTotal = record.currentTotal;
+            }
+            _sample();
+
+            _lock.endWrite(seq);
+        }
+
+        void Progress::slept(long long micros) {
+            const unsigned seq = _lock.beginWrite();
+            _snapshot.pacedSleepMicros += micros;
+            _sample();
+            _lock.endWrite(seq);
+        }
+
+        void Progress::checksumming(const StringData &path, long long done, long long total) {
+            const unsigned seq = _lock.beginWrite();
+            Snapshot &s = _snapshot;
+            s.sourceLen = std::min(path.size(), sizeof s.source);
+            memcpy(s.source, path.rawData(), s.sourceLen);
+            s.destLen = 0;
+            s.manifestDone = done;
+            s.manifestTotal = total;
+            _lock.endWrite(seq);
+        }
+
+        void Progress::_sample() {
+            Snapshot &s = _snapshot;
+            const unsigned long long now = curTimeMillis64();
+            Sample &sample = s.samples[(now / 1000) % kSamples];
+            sample.millis = now;
+            sample.bytesDone = s.bytesDone;
+            sample.sleepMicros = s.librarySleepMicros + s.pacedSleepMicros;
+        }
+
+        void Progress::read(Snapshot &out) const {
+            const Snapshot &s = _snapshot;
+            unsigned seq;
+            do {
+                seq = _lock.beginRead();
+                out.progress = s.progress;
+                out.bytesDone = s.bytesDone;
+                out.filesDone = s.filesDone;
+                out.filesTotal = s.filesTotal;
+                out.currentDone = s.currentDone;
+                out.currentTotal = s.currentTotal;
+                out.librarySleepMicros = s.librarySleepMicros;
+                out.pacedSleepMicros = s.pacedSleepMicros;
+                out.manifestDone = s.manifestDone;
+                out.manifestTotal = s.manifestTotal;
+                // The lengths may be torn if we raced with the writer, clamp them so the copy
+                // stays in bounds and let the sequence check throw the result away.
+                out.sourceLen = std::min(s.sourceLen, sizeof out.source);
+                out.destLen = std::min(s.destLen, sizeof out.dest);
+                memcpy(out.source, s.source, out.sourceLen);
+                memcpy(out.dest, s.dest, out.destLen);
+                std::copy(s.samples, s.samples + kSamples, out.samples);
+            } while (_lock.retryRead(seq));
+        }
+
+        // The latest sample taken at or before millis, or if there is none (the backup is younger
+        // than the window), the oldest one.  Slots older than kSamples seconds are stale.
+        const Progress::Sample *Progress::Snapshot::_sampleBefore(unsigned long long millis, unsigned long long now) const {
+            const Sample *before = NULL;
+            const Sample *oldest = NULL;
+            for (int i = 0; i < kSamples; ++i) {
+                const Sample &sample = samples[i];
+                if (sample.millis == 0 || sample.millis + kSamples * 1000 <= now) {
+                    continue;
+                }
+                if (sample.millis <= millis && (before == NULL || sample.millis > before->millis)) {
+                    before = &sample;
+                }
+                if (oldest == NULL || sample.millis < oldest->millis) {
+                    oldest = &sample;
+                }
+            }
+            return before != NULL ? before : oldest;
+        }
+
+        void Progress::Snapshot::getRates(BSONObjBuilder &b, unsigned long long now) const {
+            static const int windows[] = { 1, 10, 60 };
+            const long long sleepMicros = librarySleepMicros + pacedSleepMicros;
+            for (size_t i = 0; i < sizeof windows / sizeof windows[0]; ++i) {
+                const Sample *start = _sampleBefore(now - std::min(now, windows[i] * 1000ULL), now);
+                if (start == NULL || start->millis >= now) {
+                    continue;
+                }
+                const unsigned long long span = now - start->millis;
+                stringstream name;
+                name << windows[i] << "s";
+                BSONObjBuilder wb(b.subobjStart(name.str()));
+                wb.append("bytesPerSec", static_cast<long long>((bytesDone - start->bytesDone) * 1000 / span));
+                wb.append("throttledFraction", std::min(1.0, (sleepMicros - start->sleepMicros) / (span * 1000.0)));
+                wb.doneFast();
+            }
+        }
+
+        void Progress::Snapshot::get(BSONObjBuilder &b) const {
+            b.append("percent", progress * 100.0);
+            b.append("bytesDone", bytesDone);
+            {
+                BSONObjBuilder fb(b.subobjStart("files"));
+                fb.append("done", filesDone);
+                fb.append("total", filesTotal);
+                fb.doneFast();
+            }
+            {
+                BSONObjBuilder sb(b.subobjStart("throttleSleepSecs"));
+                sb.append("total", (librarySleepMicros + pacedSleepMicros) / 1000000.0);
+                sb.append("library", librarySleepMicros / 1000000.0);
+                sb.append("paced", pacedSleepMicros / 1000000.0);
+                sb.doneFast();
+            }
+            if (manifestTotal > 0) {
+                BSONObjBuilder mb(b.subobjStart("manifest"));
+                mb.append("bytesDone", manifestDone);
+                mb.append("bytesTotal", manifestTotal);
+                mb.doneFast();
+            }
+            if (sourceLen > 0) {
+                BSONObjBuilder cb(b.subobjStart("current"));
+                cb.append("source", StringData(source, sourceLen));
+                if (destLen > 0) {
+                    cb.append("dest", StringData(dest, destLen));
+                    BSONObjBuilder bb(cb.subobjStart("bytes"));
+                    bb.append("done", currentDone);
+                    bb.append("total", currentTotal);
+                    bb.doneFast();
+                }
+                cb.doneFast();
+            }
+        }
+
+    } // namespace backup
+
+} // namespace mongo
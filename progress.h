@@ -0,0 +1,156 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file progress.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <limits.h>
+
+#include "seqlock.h"
+
+#include "mongo/base/string_data.h"
+#include "mongo/db/jsobj.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * A single progress report from the backup library, decoded into its fields.  The
+         * library only hands us a human-readable string, so this is filled by a single pass
+         * over that string without allocating.  source and dest point into the poll
+         * callback's argument, so a record is only valid for the duration of that callback.
+         */
+        struct ProgressRecord {
+            enum Phase {
+                UNKNOWN,
+                PREPARING,   // "Preparing backup"
+                DISCOVERED,  // "... N more files known of. Copying file X"
+                COPYING,     // "... Copying file: D/T bytes done of X to Y."
+                THROTTLED    // "... Throttled: copied D/T bytes of X to Y. Sleeping Ss for throttling."
+            };
+            Phase phase;
+            long long bytesDone;
+            int filesDone;
+            int filesRemaining;
+            long long currentDone;
+            long long currentTotal;
+            StringData source;
+            StringData dest;
+            double sleepTime;
+
+            ProgressRecord() :
+                    phase(UNKNOWN),
+                    bytesDone(0),
+                    filesDone(0),
+                    filesRemaining(0),
+                    currentDone(0),
+                    currentTotal(0),
+                    source("", 0),
+                    dest("", 0),
+                    sleepTime(0.0)
+            {}
+            bool parse(const char *progress_string);
+        };
+
+        /**
+         * Progress is written by the backup thread on every poll and read by backupStatus.
+         * It is published through a SeqLock so that neither side ever waits on the other, and
+         * BSON is built from the reader's private copy.
+         */
+        class Progress {
+          public:
+            // The latest bytesDone and sleep time seen in each second, kept for the last
+            // kSamples seconds so rates can be reported over windows up to that long.
+            struct Sample {
+                unsigned long long millis;
+                long long bytesDone;
+                long long sleepMicros;
+
+                Sample() : millis(0), bytesDone(0), sleepMicros(0) {}
+            };
+            static const int kSamples = 64;
+
+            struct Snapshot {
+                float progress;
+                long long bytesDone;
+                int filesDone;
+                int filesTotal;
+                long long currentDone;
+                long long currentTotal;
+                size_t sourceLen;
+                size_t destLen;
+                // Time spent sleeping for the throttle, by the library and by our token bucket.
+                long long librarySleepMicros;
+                long long pacedSleepMicros;
+                // The checksum pass over the finished backup, for the manifest.
+                long long manifestDone;
+                long long manifestTotal;
+                char source[PATH_MAX];
+                char dest[PATH_MAX];
+                Sample samples[kSamples];
+
+                Snapshot() :
+                        progress(0.0),
+                        bytesDone(0),
+                        filesDone(0),
+                        filesTotal(0),
+                        currentDone(0),
+                        currentTotal(0),
+                        sourceLen(0),
+                        destLen(0),
+                        librarySleepMicros(0),
+                        pacedSleepMicros(0),
+                        manifestDone(0),
+                        manifestTotal(0)
+                {}
+                void get(BSONObjBuilder &b) const;
+
+                /**
+                 * Reports the copy rate and the fraction of time spent sleeping for the throttle
+                 * over the last 1, 10 and 60 seconds, as of now.
+                 */
+                void getRates(BSONObjBuilder &b, unsigned long long now) const;
+
+              private:
+                const Sample *_sampleBefore(unsigned long long millis, unsigned long long now) const;
+            };
+
+          private:
+            SeqLock _lock;
+            Snapshot _snapshot;
+
+            void _sample();
+
+          public:
+            Progress() : _lock(), _snapshot() {}
+            void update(float progress, const ProgressRecord &record);
+            // Records time the poll callback spent sleeping for the throttle.
+            void slept(long long micros);
+            // Reports progress of the checksum pass that writes the manifest, through path.
+            void checksumming(const StringData &path, long long done, long long total);
+            void read(Snapshot &out) const;
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,386 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file restore.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+// backup_restore: restores a hot backup taken with { backupStart: <dir>, manifest: true } into
+// an empty dbpath (and logDir, if the backup has a separate log directory), copying files on
+// several threads and checking each against the manifest's CRC32C as it's copied.
+//
+// This runs with the server stopped, so it only depends on the standard library and boost.
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <set>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "checksum.h"
+#include "file_queue.h"
+#include "manifest.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        static uint64_t nowMillis() {
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+        }
+
+        class Restorer : boost::noncopyable {
+            const Manifest &_manifest;
+            const std::string _root;
+            const std::vector<std::string> _targets;
+            const bool _verify;
+            FileQueue _queue;
+
+            boost::mutex _mutex;
+            uint64_t _bytes;
+            std::vector<std::string> _errors;
+
+            void _work() {
+                std::vector<char> buf(FileQueue::kBufferSize);
+                size_t i;
+                while (_queue.next(i)) {
+                    std::string errmsg;
+                    bool ok = _restore(_manifest.files[i], buf, errmsg);
+                    if (!ok) {
+                        // No point carrying on once something has failed.
+                        _queue.close();
+                    }
+                    boost::mutex::scoped_lock lk(_mutex);
+                    if (ok) {
+                        _bytes += _manifest.files[i].size;
+                    }
+                    else {
+                        _errors.push_back(errmsg);
+                    }
+                }
+            }
+
+            bool _restore(const Manifest::File &f, std::vector<char> &buf, std::string &errmsg) {
+                const std::string src = _manifest.destPath(_root, f);
+                const std::string dst = _targets[f.dir] + "/" + f.path;
+
+                int in = open(src.c_str(), O_RDONLY);
+                if (in < 0) {
+                    errmsg = "could not open " + src + ": " + strerror(errno);
+                    return false;
+                }
+                posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+                int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+                if (out < 0) {
+                    errmsg = "could not create " + dst + ": " + strerror(errno);
+                    close(in);
+                    return false;
+                }
+
+                bool ok = _copy(in, out, f, src, dst, buf, errmsg);
+                if (ok && fdatasync(out) != 0) {
+                    errmsg = "could not sync " + dst + ": " + strerror(errno);
+                    ok = false;
+                }
+                close(in);
+                if (close(out) != 0 && ok) {
+                    errmsg = "could not close " + dst + ": " + strerror(errno);
+                    ok = false;
+                }
+                return ok;
+            }
+
+            bool _copy(int in, int out, const Manifest::File &f, const std::string &src, const std::string &dst,
+                       std::vector<char> &buf, std::string &errmsg) {
+                if (f.size > 0) {
+                    // Get the space up front so the file is laid out contiguously, and so we find
+                    // out now rather than halfway through if it won't fit.
+                    int r = posix_fallocate(out, 0, f.size);
+                    if (r != 0 && r != EOPNOTSUPP && r != EINVAL) {
+                        errmsg = "could not allocate " + dst + ": " + strerror(r);
+                        return false;
+                    }
+                }
+
+                Crc32c crc;
+                uint64_t size = 0;
+                for (;;) {
+                    ssize_t n = read(in, &buf[0], buf.size());
+                    if (n < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        errmsg = "could not read " + src + ": " + strerror(errno);
+                        return false;
+                    }
+                    if (n == 0) {
+                        break;
+                    }
+                    if (_verify) {
+                        crc.update(&buf[0], n);
+                    }
+                    for (ssize_t written = 0; written < n; ) {
+                        ssize_t w = write(out, &buf[written], n - written);
+                        if (w < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            errmsg = "could not write " + dst + ": " + strerror(errno);
+                            return false;
+                        }
+                        written += w;
+                    }
+                    size += n;
+                }
+
+                if (size != f.size) {
+                    char msg[64];
+                    snprintf(msg, sizeof msg, ": size %llu, expected %llu",
+                             static_cast<unsigned long long>(size), static_cast<unsigned long long>(f.size));
+                    errmsg = src + msg;
+                    return false;
+                }
+                if (_verify && crc.value() != f.crc32c) {
+                    char msg[64];
+                    snprintf(msg, sizeof msg, ": crc32c %08x, expected %08x", crc.value(), f.crc32c);
+                    errmsg = src + msg;
+                    return false;
+                }
+                return true;
+            }
+
+          public:
+            Restorer(const Manifest &manifest, const std::string &root,
+                     const std::vector<std::string> &targets, bool verify) :
+                    _manifest(manifest),
+                    _root(root),
+                    _targets(targets),
+                    _verify(verify),
+                    _queue(manifest),
+                    _mutex(),
+                    _bytes(0),
+                    _errors()
+            {}
+
+            void run(size_t threads) {
+                boost::thread_group group;
+                for (size_t i = 0; i < threads; ++i) {
+                    group.create_thread(boost::bind(&Restorer::_work, this));
+                }
+                group.join_all();
+            }
+
+            uint64_t bytes() const { return _bytes; }
+            const std::vector<std::string> &errors() const { return _errors; }
+        };
+
+        static bool isEmptyDir(const boost::filesystem::path &p) {
+            return !boost::filesystem::exists(p) ||
+                    (boost::filesystem::is_directory(p) &&
+                     boost::filesystem::directory_iterator(p) == boost::filesystem::directory_iterator());
+        }
+
+        // Creates dir and any missing parents, and adds to changed every directory whose entries
+        // this changes, so they can be synced: dir itself (files go in it), each directory
+        // created, and the existing one the first of those was created in.
+        static void createDirs(const boost::filesystem::path &dir, std::set<std::string> &changed) {
+            boost::filesystem::path existing = dir;
+            while (!existing.empty() && !boost::filesystem::exists(existing)) {
+                existing = existing.parent_path();
+            }
+            boost::filesystem::create_directories(dir);
+            for (boost::filesystem::path p = dir; ; p = p.parent_path()) {
+                if (p.empty()) {
+                    changed.insert(".");
+                    break;
+                }
+                changed.insert(p.generic_string());
+                if (p == existing) {
+                    break;
+                }
+            }
+        }
+
+        static bool syncDir(const std::string &dir) {
+            int fd = open(dir.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            bool ok = fsync(fd) == 0;
+            close(fd);
+            return ok;
+        }
+
+        static void usage(const char *argv0) {
+            std::cerr << "usage: " << argv0 << " [--threads N] [--no-verify] <backup directory> <dbpath> [<logDir>]" << std::endl
+                      << "Restores a backup taken with { backupStart: <dir>, manifest: true } into an empty" << std::endl
+                      << "dbpath (and logDir, if the backup has a separate log directory; defaults to dbpath)." << std::endl;
+        }
+
+        static int restoreMain(int argc, char **argv) {
+            size_t threads = 4;
+            bool verify = true;
+            std::vector<std::string> args;
+            for (int i = 1; i < argc; ++i) {
+                const std::string arg = argv[i];
+                if (arg == "--threads" && i + 1 < argc) {
+                    threads = strtoul(argv[++i], NULL, 10);
+                    if (threads < 1 || threads > 64) {
+                        std::cerr << "--threads must be between 1 and 64" << std::endl;
+                        return 2;
+                    }
+                }
+                else if (arg == "--no-verify") {
+                    verify = false;
+                }
+                else if (arg == "--help" || arg == "-h") {
+                    usage(argv[0]);
+                    return 0;
+                }
+                else {
+                    args.push_back(arg);
+                }
+            }
+            if (args.size() < 2 || args.size() > 3) {
+                usage(argv[0]);
+                return 2;
+            }
+            const std::string root = args[0];
+            const std::string dbpath = args[1];
+            const std::string logDir = args.size() > 2 ? args[2] : dbpath;
+
+            Manifest manifest;
+            std::string errmsg;
+            if (!manifest.read(root, errmsg)) {
+                std::cerr << errmsg << std::endl;
+                return 1;
+            }
+
+            // Mirrors the layout chosen by Manager::start: one directory backed up into the root,
+            // or dbpath and logDir backed up into data/ and log/, and directories symlinked out of
+            // dbpath into data.<name>/.  Those are restored as plain directories under dbpath.
+            const std::string linkedPrefix = Manifest::kLinkedDirPrefix;
+            std::vector<std::string> targets;
+            std::set<std::string> linked;
+            for (std::vector<Manifest::Dir>::const_iterator it = manifest.dirs.begin(); it != manifest.dirs.end(); ++it) {
+                if (it->dest == "." || it->dest == "data") {
+                    targets.push_back(dbpath);
+                }
+                else if (it->dest == "log") {
+                    targets.push_back(logDir);
+                }
+                else if (it->dest.compare(0, linkedPrefix.size(), linkedPrefix) == 0 &&
+                         it->dest.size() > linkedPrefix.size()) {
+                    const std::string name = it->dest.substr(linkedPrefix.size());
+                    targets.push_back((boost::filesystem::path(dbpath) / name).generic_string());
+                    linked.insert(name);
+                }
+                else {
+                    std::cerr << "don't know where to restore backup directory " << it->dest << std::endl;
+                    return 1;
+                }
+            }
+
+            // If the copy of dbpath also went through a link, the separate copy of its target is
+            // the one to restore.
+            if (!linked.empty()) {
+                std::vector<Manifest::File> files;
+                for (std::vector<Manifest::File>::const_iterator it = manifest.files.begin(); it != manifest.files.end(); ++it) {
+                    const std::string &dest = manifest.dirs[it->dir].dest;
+                    const std::string first = boost::filesystem::path(it->path).begin()->generic_string();
+                    if ((dest == "." || dest == "data") && linked.count(first) > 0) {
+                        continue;
+                    }
+                    files.push_back(*it);
+                }
+                manifest.files.swap(files);
+            }
+
+            std::set<std::string> dirs;
+            try {
+                for (std::vector<std::string>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+                    if (!isEmptyDir(*it)) {
+                        std::cerr << *it << " is not empty, refusing to restore over it" << std::endl;
+                        return 1;
+                    }
+                }
+                // Make every directory up front so the workers never race to create one.
+                for (std::vector<std::string>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+                    createDirs(*it, dirs);
+                }
+                for (std::vector<Manifest::File>::const_iterator it = manifest.files.begin(); it != manifest.files.end(); ++it) {
+                    const boost::filesystem::path dir = (boost::filesystem::path(targets[it->dir]) / it->path).parent_path();
+                    if (dirs.count(dir.generic_string()) == 0) {
+                        createDirs(dir, dirs);
+                    }
+                }
+            } catch (const boost::filesystem::filesystem_error &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+
+            const uint64_t startTime = nowMillis();
+            Restorer restorer(manifest, root, targets, verify);
+            restorer.run(threads);
+            const uint64_t elapsed = nowMillis() - startTime;
+
+            if (!restorer.errors().empty()) {
+                for (std::vector<std::string>::const_iterator it = restorer.errors().begin(); it != restorer.errors().end(); ++it) {
+                    std::cerr << "error: " << *it << std::endl;
+                }
+                std::cerr << "restore failed, the target directories are incomplete" << std::endl;
+                return 1;
+            }
+            for (std::set<std::string>::const_iterator it = dirs.begin(); it != dirs.end(); ++it) {
+                if (!syncDir(*it)) {
+                    std::cerr << "could not sync directory " << *it << ": " << strerror(errno) << std::endl;
+                    return 1;
+                }
+            }
+
+            std::cout << "restored " << manifest.files.size() << " files, " << restorer.bytes() << " bytes in "
+                      << elapsed / 1000.0 << "s";
+            if (elapsed > 0) {
+                std::cout << " (" << restorer.bytes() * 1000 / elapsed / (1 << 20) << " MB/s)";
+            }
+            std::cout << (verify ? ", all checksums match" : "") << std::endl;
+            return 0;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
+
+int main(int argc, char **argv) {
+    return mongo::backup::restoreMain(argc, argv);
+}
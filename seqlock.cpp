@@ -0,0 +1,64 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file seqlock.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "seqlock.h"
+
+#include <sched.h>
+
+namespace mongo {
+
+    namespace backup {
+
+        // The fences keep the protected state's plain stores between the odd and the even
+        // _seq stores, and a reader's plain loads between its two _seq loads, as seen from
+        // other CPUs.
+        unsigned SeqLock::beginWrite() {
+            const unsigned seq = _seq.load();
+            _seq.store(seq + 1);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return seq;
+        }
+
+        void SeqLock::endWrite(unsigned seq) {
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            _seq.store(seq + 2);
+        }
+
+        unsigned SeqLock::beginRead() const {
+            for (;;) {
+                const unsigned seq = _seq.load();
+                if (!(seq & 1)) {
+                    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                    return seq;
+                }
+                // Writer is mid-update, it'll be done in a moment.
+                sched_yield();
+            }
+        }
+
+        bool SeqLock::retryRead(unsigned seq) const {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return _seq.load() != seq;
+        }
+
+    } // namespace backup
+
+} // namespace mongo
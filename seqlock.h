@@ -0,0 +1,61 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file seqlock.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include "mongo/platform/atomic_word.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * A sequence lock, for state the backup's threads update while status readers look on,
+         * where the writer must never wait for a reader.  A writer makes the sequence odd,
+         * changes the protected state, and makes it even again; a reader notes the sequence,
+         * copies the state out, and starts over if the sequence was odd or has changed.  Writers
+         * must be serialized by other means, and the protected state must be safe to copy while
+         * it's being written (plain values and fixed-size arrays, no pointers followed).
+         *
+         *     const unsigned seq = lock.beginWrite();       unsigned seq;
+         *     ... update ...                                do {
+         *     lock.endWrite(seq);                               seq = lock.beginRead();
+         *                                                       ... copy out ...
+         *                                                   } while (lock.retryRead(seq));
+         */
+        class SeqLock : boost::noncopyable {
+            AtomicUInt32 _seq;
+
+          public:
+            SeqLock() : _seq(0) {}
+
+            unsigned beginWrite();
+            void endWrite(unsigned seq);
+
+            unsigned beginRead() const;
+            bool retryRead(unsigned seq) const;
+        };
+
+    } // namespace backup
+
+} // namespace mongo
@@ -0,0 +1,479 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file throttle.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "mongo/pch.h"
+
+#include "throttle.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+#include <time.h>
+
+#include <backup.h>
+
+#include "mongo/base/status.h"
+#include "mongo/base/units.h"
+#include "mongo/db/jsobj.h"
+#include "mongo/db/stats/top.h"
+#include "mongo/util/concurrency/mutex.h"
+#include "mongo/util/debug_util.h"
+#include "mongo/util/log.h"
+#include "mongo/util/time_support.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        SimpleMutex Throttle::_mutex("backup throttle");
+        Throttle::Mode Throttle::_mode = Throttle::UNTHROTTLED;
+        long long Throttle::_bps = 0;
+        Throttle::Controller Throttle::_controller;
+        std::vector<Throttle::Window> Throttle::_schedule;
+        long long Throttle::_scheduleDefaultBps = 0;
+        unsigned long long Throttle::_scheduleCheckedMillis = 0;
+        Throttle::Bucket Throttle::_bucket;
+        SeqLock Throttle::_publishedLock;
+        Throttle::Published Throttle::_published;
+
+        void Throttle::Controller::reset() {
+            targetLatencyMicros = 0;
+            minBps = kDefaultMinBps;
+            maxBps = 0;
+            lastSampleMillis = 0;
+            lastBytesDone = 0;
+            lastOpMicros = 0;
+            lastOpCount = 0;
+            observedLatencyMicros = -1;
+            measuredBps = -1;
+        }
+
+        static bool parseBps(const BSONElement &e, const char *what, long long &bps, string &errmsg) {
+            if (e.type() == String) {
+                Status status = BytesQuantity<long long>::fromString(e.Stringdata(), bps);
+                if (!status.isOK()) {
+                    stringstream ss;
+                    ss << "error parsing number " << e.Stringdata() << ": " << status.codeString() << " " << status.reason();
+                    errmsg = ss.str();
+                    return false;
+                }
+            }
+            else {
+                if (!e.isNumber()) {
+                    errmsg = string(what) + " must be a number";
+                    return false;
+                }
+                bps = e.safeNumberLong();
+            }
+            if (bps < 0) {
+                errmsg = string(what) + " cannot be negative";
+                return false;
+            }
+            return true;
+        }
+
+        static bool parseTimeOfDay(const BSONElement &e, const char *what, int &minute, string &errmsg) {
+            int hours;
+            int minutes;
+            char extra;
+            if (e.type() != String ||
+                sscanf(e.valuestr(), "%d:%d%c", &hours, &minutes, &extra) != 2 ||
+                hours < 0 || hours > 24 || minutes < 0 || minutes > 59 || (hours == 24 && minutes != 0)) {
+                errmsg = string(what) + " must be a time of day \"HH:MM\"";
+                return false;
+            }
+            minute = hours * 60 + minutes;
+            return true;
+        }
+
+        static string formatTimeOfDay(int minute) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "%02d:%02d", minute / 60, minute % 60);
+            return buf;
+        }
+
+        static int localMinuteOfDay(unsigned long long millis) {
+            const time_t t = millis / 1000;
+            struct tm tm;
+            localtime_r(&t, &tm);
+            return tm.tm_hour * 60 + tm.tm_min;
+        }
+
+        bool Throttle::Window::contains(int minute) const {
+            if (from < to) {
+                return from <= minute && minute < to;
+            }
+            return minute >= from || minute < to;
+        }
+
+        // Total time and count of foreground queries, inserts, updates and deletes since startup.
+        // getmores and commands are left out: tailing cursors and long-running commands (like a
+        // synchronous backupStart) would swamp the average.
+        static void foregroundOpUsage(long long &micros, long long &count) {
+            const Top::CollectionData d = Top::global.getGlobalData();
+            micros = d.queries.time + d.insert.time + d.update.time + d.remove.time;
+            count = d.queries.count + d.insert.count + d.update.count + d.remove.count;
+        }
+
+        void Throttle::_publish() {
+            const unsigned seq = _publishedLock.beginWrite();
+            Published &p = _published;
+            p.mode = _mode;
+            p.bps = _bps;
+            p.burst = _bucket.burst;
+            p.controller = _controller;
+            p.scheduleSize = _schedule.size();
+            std::copy(_schedule.begin(), _schedule.end(), p.schedule);
+            p.scheduleDefaultBps = _scheduleDefaultBps;
+            _publishedLock.endWrite(seq);
+        }
+
+        void Throttle::_apply(long long bps) {
+            _bps = bps;
+            _publish();
+            if (_bucket.burst > 0) {
+                tokubackup_throttle_backup(std::numeric_limits<unsigned long>::max());
+            }
+            else {
+                tokubackup_throttle_backup(bps);
+            }
+        }
+
+        bool Throttle::set(const BSONElement &e, const BSONElement &burstElt, string &errmsg, BSONObjBuilder &result) {
+            // Parse and check everything before changing anything, so an error leaves the
+            // throttle as it was.
+            long long burst = 0;
+            if (!burstElt.eoo() && !parseBps(burstElt, "burst", burst, errmsg)) {
+                return false;
+            }
+
+            Mode mode;
+            long long bps = 0;
+            Controller c;
+            std::vector<Window> schedule;
+            long long defaultBps = 0;
+            if (e.type() != Object) {
+                if (!parseBps(e, "backupThrottle argument", bps, errmsg)) {
+                    return false;
+                }
+                mode = FIXED;
+            }
+            else if (e.Obj().hasField("schedule")) {
+                if (!_parseSchedule(e.Obj(), schedule, defaultBps, errmsg)) {
+                    return false;
+                }
+                mode = SCHEDULED;
+            }
+            else {
+                if (!_parseController(e.Obj(), c, errmsg)) {
+                    return false;
+                }
+                mode = ADAPTIVE;
+            }
+
+            if (burst > 0) {
+                // A zero rate goes to the library as is, but the bucket would have to stop the
+                // copy outright to match it, so don't pretend to support that.
+                bool zero = mode == FIXED ? bps == 0 : mode == SCHEDULED && defaultBps == 0;
+                for (std::vector<Window>::const_iterator it = schedule.begin(); it != schedule.end(); ++it) {
+                    zero = zero || it->bps == 0;
+                }
+                if (zero) {
+                    errmsg = "burst cannot be used with a rate of 0";
+                    return false;
+                }
+            }
+
+            SimpleMutex::scoped_lock lk(_mutex);
+            if (burst != _bucket.burst) {
+                // Start full, poll() takes its baseline on the next callback.
+                _bucket = Bucket();
+                _bucket.burst = burst;
+                _bucket.tokens = burst;
+            }
+            _mode = mode;
+            switch (mode) {
+            case FIXED:
+                DEV LOG(0) << "Throttling backup to " << bps << endl;
+                _apply(bps);
+                break;
+            case ADAPTIVE:
+                DEV LOG(0) << "Throttling backup adaptively to " << c.targetLatencyMicros << "us latency" << endl;
+                // Start from the bottom and let the controller find its way up.
+                _controller = c;
+                _apply(c.minBps);
+                break;
+            case SCHEDULED:
+                DEV LOG(0) << "Throttling backup on a schedule of " << schedule.size() << " windows" << endl;
+                _schedule.swap(schedule);
+                _scheduleDefaultBps = defaultBps;
+                // The burst may have changed even if the rate didn't.
+                _applySchedule(curTimeMillis64(), true);
+                break;
+            case UNTHROTTLED:
+                break;
+            }
+            return true;
+        }
+
+        bool Throttle::_parseController(const BSONObj &spec, Controller &c, string &errmsg) {
+            BSONElement targetElt = spec["targetLatencyMs"];
+            if (!targetElt.isNumber() || targetElt.number() <= 0) {
+                errmsg = "adaptive backupThrottle requires a positive targetLatencyMs";
+                return false;
+            }
+            c.targetLatencyMicros = static_cast<long long>(targetElt.number() * 1000);
+            if (!spec["minBps"].eoo() && !parseBps(spec["minBps"], "minBps", c.minBps, errmsg)) {
+                return false;
+            }
+            if (c.minBps <= 0) {
+                // The controller works in multiples of the current rate, it could never get off 0.
+                errmsg = "adaptive backupThrottle requires a positive minBps";
+                return false;
+            }
+            if (!spec["maxBps"].eoo() && !parseBps(spec["maxBps"], "maxBps", c.maxBps, errmsg)) {
+                return false;
+            }
+            if (c.maxBps > 0 && c.maxBps < c.minBps) {
+                errmsg = "maxBps cannot be less than minBps";
+                return false;
+            }
+            return true;
+        }
+
+        bool Throttle::_parseSchedule(const BSONObj &spec, std::vector<Window> &schedule, long long &defaultBps, string &errmsg) {
+            BSONElement scheduleElt = spec["schedule"];
+            if (scheduleElt.type() != Array) {
+                errmsg = "schedule must be an array";
+                return false;
+            }
+            BSONObjIterator it(scheduleElt.Obj());
+            while (it.more()) {
+                BSONElement windowElt = it.next();
+                if (windowElt.type() != Object) {
+                    errmsg = "schedule entries must be objects { from: \"HH:MM\", to: \"HH:MM\", bps: <N> }";
+                    return false;
+                }
+                const BSONObj window = windowElt.Obj();
+                Window w;
+                if (!parseTimeOfDay(window["from"], "from", w.from, errmsg) ||
+                    !parseTimeOfDay(window["to"], "to", w.to, errmsg) ||
+                    !parseBps(window["bps"], "bps", w.bps, errmsg)) {
+                    return false;
+                }
+                if (w.from == w.to) {
+                    errmsg = "schedule window cannot be empty (from == to)";
+                    return false;
+                }
+                w.from %= 24 * 60;
+                w.to %= 24 * 60;
+                schedule.push_back(w);
+            }
+            if (schedule.empty()) {
+                errmsg = "schedule cannot be empty";
+                return false;
+            }
+            if (schedule.size() > static_cast<size_t>(kMaxScheduleWindows)) {
+                stringstream ss;
+                ss << "schedule cannot have more than " << kMaxScheduleWindows << " windows";
+                errmsg = ss.str();
+                return false;
+            }
+            if (spec["defaultBps"].eoo()) {
+                errmsg = "scheduled backupThrottle requires defaultBps, the rate outside every window";
+                return false;
+            }
+            return parseBps(spec["defaultBps"], "defaultBps", defaultBps, errmsg);
+        }
+
+        void Throttle::_applySchedule(unsigned long long now, bool force) {
+            const int minute = localMinuteOfDay(now);
+            long long bps = _scheduleDefaultBps;
+            for (std::vector<Window>::const_iterator it = _schedule.begin(); it != _schedule.end(); ++it) {
+                if (it->contains(minute)) {
+                    bps = it->bps;
+                    break;
+                }
+            }
+            _scheduleCheckedMillis = now;
+            if (force || bps != _bps) {
+                LOG(0) << "Scheduled backup throttle: " << formatTimeOfDay(minute) << ", "
+                       << _bps << " -> " << bps << " bytes/sec" << endl;
+                _apply(bps);
+            }
+        }
+
+        long long Throttle::poll(long long bytesDone) {
+            return _poll(bytesDone, false);
+        }
+
+        long long Throttle::pace(long long bytesDone) {
+            return _poll(bytesDone, true);
+        }
+
+        long long Throttle::_poll(long long bytesDone, bool selfPaced) {
+            SimpleMutex::scoped_lock lk(_mutex);
+            if (_mode == SCHEDULED) {
+                const unsigned long long now = curTimeMillis64();
+                if (now >= _scheduleCheckedMillis + kAdaptiveIntervalMillis) {
+                    _applySchedule(now);
+                }
+            }
+            else if (_mode == ADAPTIVE) {
+                _adapt(bytesDone);
+            }
+            return _pace(bytesDone, selfPaced);
+        }
+
+        long long Throttle::_pace(long long bytesDone, bool selfPaced) {
+            Bucket &b = _bucket;
+            const long long burst = b.burst > 0 ? b.burst : selfPaced ? kSelfPacedBurst : 0;
+            // set() refuses a burst with a rate of 0, so that only leaves our own reads while
+            // the library is told 0, and there's no pace to hold them to.
+            if (burst <= 0 || _mode == UNTHROTTLED || _bps <= 0) {
+                return 0;
+            }
+
+            const unsigned long long now = curTimeMicros64();
+            if (b.lastMicros == 0 || bytesDone < b.lastBytesDone) {
+                // First callback of a backup, or of a pass over it.
+                b.tokens = burst;
+            }
+            else {
+                const long long refill = static_cast<long long>((now - b.lastMicros) * (static_cast<double>(_bps) / 1000000));
+                b.tokens = std::min(burst, b.tokens + refill);
+                b.tokens -= bytesDone - b.lastBytesDone;
+            }
+            b.lastMicros = now;
+            b.lastBytesDone = bytesDone;
+
+            if (b.tokens >= 0) {
+                return 0;
+            }
+            // Whatever we don't sleep off now stays owed, and gets slept off once it adds up.
+            const long long wait = static_cast<long long>(-b.tokens * (1000000.0 / _bps));
+            return wait >= kMinPaceMicros ? wait : 0;
+        }
+
+        void Throttle::_adapt(long long bytesDone) {
+            Controller &c = _controller;
+            const unsigned long long now = curTimeMillis64();
+            if (c.lastSampleMillis != 0 && now < c.lastSampleMillis + kAdaptiveIntervalMillis) {
+                return;
+            }
+
+            long long opMicros;
+            long long opCount;
+            foregroundOpUsage(opMicros, opCount);
+
+            const unsigned long long elapsed = now - c.lastSampleMillis;
+            if (c.lastSampleMillis != 0 && elapsed <= 10 * kAdaptiveIntervalMillis && bytesDone >= c.lastBytesDone) {
+                // Otherwise this is the first sample of a new backup, or we haven't heard from the
+                // backup in a long time, and we just take a new baseline.
+                c.measuredBps = (bytesDone - c.lastBytesDone) * 1000 / elapsed;
+
+                const long long ops = opCount - c.lastOpCount;
+                if (ops > 0) {
+                    c.observedLatencyMicros = (opMicros - c.lastOpMicros) / ops;
+                }
+
+                long long bps;
+                if (ops > 0 && c.observedLatencyMicros > c.targetLatencyMicros) {
+                    bps = std::max(c.minBps, _bps * 7 / 10);
+                }
+                else {
+                    // Don't run away while the backup can't keep up with the current rate anyway
+                    // (e.g. it's stuck on a slow disk), or we'd take forever to come back down.
+                    bps = _bps + _bps / 10 + kDefaultMinBps;
+                    bps = std::min(bps, std::max(2 * c.measuredBps, c.minBps));
+                    if (c.maxBps > 0) {
+                        bps = std::min(bps, c.maxBps);
+                    }
+                    bps = std::max(bps, _bps);
+                }
+                if (bps != _bps) {
+                    LOG(1) << "Adaptive backup throttle: latency " << c.observedLatencyMicros
+                           << "us, target " << c.targetLatencyMicros << "us, "
+                           << _bps << " -> " << bps << " bytes/sec" << endl;
+                    _apply(bps);
+                }
+            }
+
+            c.lastSampleMillis = now;
+            c.lastBytesDone = bytesDone;
+            c.lastOpMicros = opMicros;
+            c.lastOpCount = opCount;
+            _publish();
+        }
+
+        void Throttle::get(BSONObjBuilder &b) {
+            Published p;
+            unsigned seq;
+            do {
+                seq = _publishedLock.beginRead();
+                p = _published;
+            } while (_publishedLock.retryRead(seq));
+
+            if (p.burst > 0) {
+                b.append("burst", p.burst);
+            }
+            switch (p.mode) {
+            case UNTHROTTLED:
+                b.append("mode", "none");
+                return;
+            case FIXED:
+                b.append("mode", "fixed");
+                b.append("bps", p.bps);
+                return;
+            case ADAPTIVE:
+                b.append("mode", "adaptive");
+                b.append("bps", p.bps);
+                b.append("targetLatencyMs", p.controller.targetLatencyMicros / 1000.0);
+                if (p.controller.observedLatencyMicros >= 0) {
+                    b.append("observedLatencyMs", p.controller.observedLatencyMicros / 1000.0);
+                }
+                if (p.controller.measuredBps >= 0) {
+                    b.append("measuredBps", p.controller.measuredBps);
+                }
+                b.append("minBps", p.controller.minBps);
+                if (p.controller.maxBps > 0) {
+                    b.append("maxBps", p.controller.maxBps);
+                }
+                return;
+            case SCHEDULED: {
+                b.append("mode", "schedule");
+                b.append("bps", p.bps);
+                BSONArrayBuilder sb(b.subarrayStart("schedule"));
+                for (const Window *it = p.schedule; it != p.schedule + p.scheduleSize; ++it) {
+                    BSONObjBuilder wb(sb.subobjStart());
+                    wb.append("from", formatTimeOfDay(it->from));
+                    wb.append("to", formatTimeOfDay(it->to));
+                    wb.append("bps", it->bps);
+                    wb.doneFast();
+                }
+                sb.doneFast();
+                b.append("defaultBps", p.scheduleDefaultBps);
+                return;
+            }
+            }
+        }
+
+    } // namespace backup
+
+} // namespace mongo
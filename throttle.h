@@ -0,0 +1,178 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file throttle.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include "mongo/pch.h"
+
+#include <vector>
+
+#include "seqlock.h"
+
+#include "mongo/db/jsobj.h"
+#include "mongo/util/concurrency/mutex.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * Owns the rate given to the backup library with tokubackup_throttle_backup.  The rate is
+         * either fixed by the user, or, in adaptive mode, chosen by a feedback loop that runs on
+         * the backup's poll callbacks: about once a second it looks at the average latency of
+         * foreground queries, inserts, updates and deletes since the last look, backs the copy
+         * rate off multiplicatively if that latency is over the target, and otherwise raises it
+         * (additively, and never much past what the backup is actually achieving).  In scheduled
+         * mode, the poll callbacks pick the rate for the current local time of day from a list of
+         * windows, so a long backup can run faster off-peak without anyone resetting the rate.
+         *
+         * Whatever the mode, the rate can be enforced either by the library, which copies a burst
+         * and then sleeps for as long as it takes to get back under the rate, or, if a burst size
+         * is given, by a token bucket here: the library is left unthrottled, and each poll
+         * callback sleeps off the bytes copied beyond the bucket, as soon as there's a
+         * kMinPaceMicros worth of them, so the copy is held to the rate in small steps instead of
+         * stop-and-go.  That is as fine-grained as the library's poll callbacks are frequent.
+         *
+         * _mutex serializes backupThrottle and the poll callbacks.  Whenever they change what
+         * get() reports, they publish a copy of it through a SeqLock, so backupStatus never
+         * holds up the copy.
+         */
+        class Throttle {
+          public:
+            enum Mode {
+                UNTHROTTLED,
+                FIXED,
+                ADAPTIVE,
+                SCHEDULED
+            };
+
+            static const int kMaxScheduleWindows = 48;
+
+          private:
+            struct Controller {
+                long long targetLatencyMicros;
+                long long minBps;
+                long long maxBps;  // 0 means no cap
+
+                unsigned long long lastSampleMillis;
+                long long lastBytesDone;
+                long long lastOpMicros;
+                long long lastOpCount;
+
+                long long observedLatencyMicros;
+                long long measuredBps;
+
+                Controller() { reset(); }
+                void reset();
+            };
+
+            struct Window {
+                // Minutes since local midnight, [from, to), wrapping past midnight if to <= from.
+                int from;
+                int to;
+                long long bps;
+
+                bool contains(int minute) const;
+            };
+
+            struct Bucket {
+                long long burst;  // 0 means the library throttles instead
+                long long tokens;
+                unsigned long long lastMicros;
+                long long lastBytesDone;
+
+                Bucket() : burst(0), tokens(0), lastMicros(0), lastBytesDone(0) {}
+            };
+
+            // What get() reports, copied out of the state below whenever it changes.
+            struct Published {
+                Mode mode;
+                long long bps;
+                long long burst;
+                Controller controller;
+                Window schedule[kMaxScheduleWindows];
+                int scheduleSize;
+                long long scheduleDefaultBps;
+
+                Published() : mode(UNTHROTTLED), bps(0), burst(0), controller(), scheduleSize(0), scheduleDefaultBps(0) {}
+            };
+
+            static SimpleMutex _mutex;
+            static Mode _mode;
+            static long long _bps;
+            static Controller _controller;
+            static std::vector<Window> _schedule;
+            static long long _scheduleDefaultBps;
+            static unsigned long long _scheduleCheckedMillis;
+            static Bucket _bucket;
+            static SeqLock _publishedLock;
+            static Published _published;
+
+            // Called with _mutex held.
+            static void _publish();
+            static void _apply(long long bps);
+            static bool _parseController(const BSONObj &spec, Controller &c, string &errmsg);
+            static bool _parseSchedule(const BSONObj &spec, std::vector<Window> &schedule, long long &defaultBps, string &errmsg);
+            // Applies the rate for now if it differs from the current one, or regardless if force.
+            static void _applySchedule(unsigned long long now, bool force = false);
+            static void _adapt(long long bytesDone);
+            static long long _poll(long long bytesDone, bool selfPaced);
+            static long long _pace(long long bytesDone, bool selfPaced);
+
+          public:
+            static const unsigned long long kAdaptiveIntervalMillis = 1000;
+            static const long long kDefaultMinBps = 1 << 20;
+            static const long long kMinPaceMicros = 1000;
+            // The bucket for reads we pace ourselves when no burst was given.
+            static const long long kSelfPacedBurst = 1 << 20;
+
+            /**
+             * Handles the argument to backupThrottle: a number of bytes/sec (possibly a string
+             * with a k/m/g suffix) sets a fixed rate, and an object
+             * { targetLatencyMs: <N>, minBps: <N>, maxBps: <N> } switches to adaptive mode, and
+             * { schedule: [ { from: "HH:MM", to: "HH:MM", bps: <N> }, ... ], defaultBps: <N> }
+             * (up to kMaxScheduleWindows windows) switches to scheduled mode, where the first
+             * window containing the current local time gives the rate, or defaultBps if there is
+             * none.  A positive burst (bytes, possibly with a suffix) paces the copy here with a
+             * token bucket of that size, otherwise the library throttles; a burst can't be
+             * combined with a rate of 0.  Nothing changes unless the whole request is valid.
+             */
+            static bool set(const BSONElement &e, const BSONElement &burst, string &errmsg, BSONObjBuilder &result);
+
+            /**
+             * Called from the backup's poll callback with the total bytes copied so far.  Returns
+             * how many microseconds the callback should sleep to keep the copy to the rate.
+             */
+            static long long poll(long long bytesDone);
+
+            /**
+             * Like poll(), for reads the plugin does itself (e.g. checksumming a finished
+             * backup), which the library's throttle doesn't see: they're always paced with the
+             * token bucket, using a kSelfPacedBurst bucket if no burst was given.
+             */
+            static long long pace(long long bytesDone);
+
+            static void get(BSONObjBuilder &b);
+        };
+
+    } // namespace backup
+
+} // namespace mongo
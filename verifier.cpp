@@ -0,0 +1,180 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file verifier.cpp
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+#include "verifier.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <boost/bind.hpp>
+
+#include "checksum.h"
+#include "manifest.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        Verifier::Verifier(const Manifest &manifest, const std::string &root) :
+                _manifest(manifest),
+                _root(root),
+                _queue(manifest),
+                _running(0),
+                _aborted(false),
+                _filesDone(0),
+                _bytesDone(0)
+        {}
+
+        Verifier::~Verifier() {
+            abort();
+            _threads.join_all();
+        }
+
+        bool Verifier::_findUnexpected(std::string &errmsg) {
+            Manifest onDisk;
+            onDisk.dirs = _manifest.dirs;
+            onDisk.oplog = _manifest.oplog;
+            if (!onDisk.list(_root, errmsg)) {
+                return false;
+            }
+            std::set<std::pair<size_t, std::string> > expected;
+            for (std::vector<Manifest::File>::const_iterator it = _manifest.files.begin(); it != _manifest.files.end(); ++it) {
+                expected.insert(std::make_pair(it->dir, it->path));
+            }
+            for (std::vector<Manifest::File>::const_iterator it = onDisk.files.begin(); it != onDisk.files.end(); ++it) {
+                if (expected.count(std::make_pair(it->dir, it->path)) == 0) {
+                    const std::string &dir = onDisk.dirs[it->dir].dest;
+                    _unexpected.push_back(dir == "." ? it->path : dir + "/" + it->path);
+                }
+            }
+            return true;
+        }
+
+        bool Verifier::start(size_t threads, std::string &errmsg) {
+            if (!_findUnexpected(errmsg)) {
+                return false;
+            }
+            boost::mutex::scoped_lock lk(_mutex);
+            for (size_t i = 0; i < std::max(threads, static_cast<size_t>(1)); ++i) {
+                _threads.create_thread(boost::bind(&Verifier::_work, this));
+                ++_running;
+            }
+            return true;
+        }
+
+        bool Verifier::wait(unsigned long long timeoutMillis) {
+            const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeoutMillis);
+            boost::mutex::scoped_lock lk(_mutex);
+            while (_running > 0) {
+                if (!_doneCond.timed_wait(lk, deadline)) {
+                    return _running == 0;
+                }
+            }
+            return true;
+        }
+
+        void Verifier::abort() {
+            _queue.close();
+            boost::mutex::scoped_lock lk(_mutex);
+            _aborted = true;
+        }
+
+        bool Verifier::read(const std::string &path, uint64_t done, size_t len) {
+            return !aborted();
+        }
+
+        bool Verifier::aborted() const {
+            boost::mutex::scoped_lock lk(_mutex);
+            return _aborted;
+        }
+
+        uint64_t Verifier::filesDone() const {
+            boost::mutex::scoped_lock lk(_mutex);
+            return _filesDone;
+        }
+
+        uint64_t Verifier::bytesDone() const {
+            boost::mutex::scoped_lock lk(_mutex);
+            return _bytesDone;
+        }
+
+        void Verifier::_work() {
+            std::vector<char> buf(FileQueue::kBufferSize);
+            size_t i;
+            while (_queue.next(i)) {
+                _check(i, buf);
+            }
+            boost::mutex::scoped_lock lk(_mutex);
+            if (--_running == 0) {
+                _doneCond.notify_all();
+            }
+        }
+
+        void Verifier::_check(size_t i, std::vector<char> &buf) {
+            const Manifest::File &f = _manifest.files[i];
+            const std::string path = _manifest.destPath(_root, f);
+
+            Problem p;
+            p.file = i;
+            std::vector<Problem> *list = NULL;
+            uint64_t size = 0;
+
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) {
+                p.what = strerror(errno);
+                list = errno == ENOENT ? &_missing : &_errors;
+            }
+            else if (static_cast<uint64_t>(st.st_size) != f.size) {
+                // No need to read it to know it's wrong.
+                char msg[64];
+                snprintf(msg, sizeof msg, "size %llu, expected %llu",
+                         static_cast<unsigned long long>(st.st_size), static_cast<unsigned long long>(f.size));
+                p.what = msg;
+                list = &_mismatched;
+            }
+            else {
+                uint32_t crc;
+                if (!checksumFile(path, buf, size, crc, p.what, this)) {
+                    list = &_errors;
+                }
+                else if (crc != f.crc32c || size != f.size) {
+                    char msg[64];
+                    snprintf(msg, sizeof msg, "crc32c %08x, expected %08x", crc, f.crc32c);
+                    p.what = msg;
+                    list = &_mismatched;
+                }
+            }
+
+            boost::mutex::scoped_lock lk(_mutex);
+            ++_filesDone;
+            _bytesDone += size;
+            if (list != NULL) {
+                list->push_back(p);
+            }
+        }
+
+    } // namespace backup
+
+} // namespace mongo
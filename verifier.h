@@ -0,0 +1,111 @@
+/* -*- mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+// vim: ft=cpp:expandtab:ts=8:sw=4:softtabstop=4:
+// @file verifier.h
+
+/*======
+This file is part of Percona Server for MongoDB.
+Copyright (c) 2006, 2015, Percona and/or its affiliates. All rights reserved.
+    Percona Server for MongoDB is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Affero General
+    Public License, version 3, as published by the Free Software
+    Foundation.
+    Percona Server for MongoDB is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+    See the GNU Affero General Public License for more details.
+    You should have received a copy of the GNU Affero General Public
+    License along with Percona Server for MongoDB.  If not, see
+    <http://www.gnu.org/licenses/>.  
+======= */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "checksum.h"
+#include "file_queue.h"
+#include "manifest.h"
+
+namespace mongo {
+
+    namespace backup {
+
+        /**
+         * Checks the files of a backup against its manifest on a pool of threads, which take
+         * files from a FileQueue.  Files in the backup that the manifest doesn't list are
+         * reported as unexpected.
+         */
+        class Verifier : boost::noncopyable, private ChecksumListener {
+          public:
+            struct Problem {
+                size_t file;
+                std::string what;
+            };
+
+          private:
+            const Manifest &_manifest;
+            const std::string _root;
+            FileQueue _queue;
+
+            mutable boost::mutex _mutex;
+            boost::condition _doneCond;
+            boost::thread_group _threads;
+            size_t _running;
+            bool _aborted;
+            uint64_t _filesDone;
+            uint64_t _bytesDone;
+            std::vector<Problem> _missing;
+            std::vector<Problem> _mismatched;
+            std::vector<Problem> _errors;
+            // Relative to the root.
+            std::vector<std::string> _unexpected;
+
+            void _work();
+            void _check(size_t i, std::vector<char> &buf);
+            bool _findUnexpected(std::string &errmsg);
+            virtual bool read(const std::string &path, uint64_t done, size_t len);
+
+          public:
+            Verifier(const Manifest &manifest, const std::string &root);
+            ~Verifier();
+
+            /**
+             * Looks for unexpected files, then starts checking on the given number of threads.
+             * Returns false with errmsg set if the backup can't be listed.
+             */
+            bool start(size_t threads, std::string &errmsg);
+
+            /**
+             * Returns true once every thread has finished, or false after timeoutMillis.
+             */
+            bool wait(unsigned long long timeoutMillis);
+
+            /**
+             * Stops handing out files, and stops reading the ones being read at their next
+             * buffer.
+             */
+            void abort();
+
+            bool aborted() const;
+            uint64_t filesDone() const;
+            uint64_t bytesDone() const;
+
+            // Only meaningful once wait() has returned true.
+            const std::vector<Problem> &missing() const { return _missing; }
+            const std::vector<Problem> &mismatched() const { return _mismatched; }
+            const std::vector<Problem> &errors() const { return _errors; }
+            const std::vector<std::string> &unexpected() const { return _unexpected; }
+        };
+
+    } // namespace backup
+
+} // namespace mongo